@@ -1,14 +1,88 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <memory>
+#include <new>
 #include <nlohmann/json.hpp>
+#include <optional>
+#include <span>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <climits>
+
+#include <cerrno>
+#include <coroutine>
+#include <exception>
+#include <system_error>
+#endif
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define BINARY_SCHEMA_HAS_CRC32C_HW 1
+#endif
+
+// 例外を無効にしたビルド (-fno-exceptions) では、送出する代わりに
+// メッセージを出して abort する。そのようなビルドではアクセスに例外を
+// 投げない try* API を使い、失敗で止まるのはスキーマの読み込みだけにする。
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+#define BINARY_SCHEMA_EXCEPTIONS 1
+#define BS_THROW(ex) throw ex
+#else
+#define BINARY_SCHEMA_EXCEPTIONS 0
+#define BS_THROW(ex) ::bs_detail::fatal(ex)
+namespace bs_detail {
+template <typename E>
+[[noreturn]] void fatal(const E& e) {
+  std::fprintf(stderr, "fatal: %s\n", e.what());
+  std::abort();
+}
+}  // namespace bs_detail
+#endif
+
 // --- 1) 型コード定義 ---
-enum class FieldType : uint8_t { UINT8, UINT16, UINT32, INT32, BLOB, BITFIELD };
+enum class FieldType : uint8_t {
+  UINT8,
+  UINT16,
+  UINT32,
+  INT32,
+  BLOB,
+  BITFIELD,
+  CRC32C
+};
 
 // --- 2) フィールド記述子 ---
 struct FieldDesc {
@@ -18,42 +92,605 @@ struct FieldDesc {
   size_t offset = 0;
   size_t bitOffset = 0;
   uint8_t bitLength = 0;
+  // CRC32C フィールドのみ: 対象バイト範囲 [checksumBegin, checksumEnd)
+  size_t checksumBegin = 0;
+  size_t checksumEnd = 0;
+  // 固定値フィールド: デコード時に constValue と一致するか検証する
+  bool hasConst = false;
+  uint64_t constValue = 0;
+  // テンプレートの初期値 ("default" 指定がなければ 0)
+  uint64_t defaultValue = 0;
 };
 
 // --- 3) ビット操作ユーティリティ ---
-static uint64_t readBits(const std::vector<char>& buf, size_t bitOffset,
-                         uint8_t bitWidth) {
-  size_t byte0 = bitOffset / 8;
-  size_t byte1 = (bitOffset + bitWidth - 1) / 8;
+// 値は LSB ファーストで詰める。bitOffset % 8 != 0 の 64 ビット値は 9 バイトに
+// またがるので、8 バイトを超える分は最後の 1 バイトで扱う。
+static uint64_t loadBits(const char* base, size_t bitOffset, uint8_t bitWidth) {
+  const char* p = base + bitOffset / 8;
+  const unsigned shift = bitOffset % 8;
+  const size_t span = (shift + bitWidth + 7) / 8;
   uint64_t chunk = 0;
-  std::memcpy(&chunk, buf.data() + byte0, byte1 - byte0 + 1);
-  chunk >>= (bitOffset % 8);
+  std::memcpy(&chunk, p, span < 8 ? span : 8);
+  chunk >>= shift;
+  if (span > 8)
+    chunk |= static_cast<uint64_t>(static_cast<uint8_t>(p[8])) << (64 - shift);
   uint64_t mask = (bitWidth == 64 ? ~0ull : ((1ull << bitWidth) - 1));
   return chunk & mask;
 }
+// 同じバイトを共有する前後のビットは保持する
+static void storeBits(char* base, size_t bitOffset, uint8_t bitWidth,
+                      uint64_t value) {
+  char* p = base + bitOffset / 8;
+  const unsigned shift = bitOffset % 8;
+  const size_t span = (shift + bitWidth + 7) / 8;
+  const size_t lo = span < 8 ? span : 8;
+  uint64_t mask = (bitWidth == 64 ? ~0ull : ((1ull << bitWidth) - 1));
+  value &= mask;
+  uint64_t chunk = 0;
+  std::memcpy(&chunk, p, lo);
+  chunk = (chunk & ~(mask << shift)) | (value << shift);
+  std::memcpy(p, &chunk, lo);
+  if (span > 8) {
+    uint8_t hiMask = static_cast<uint8_t>(mask >> (64 - shift));
+    uint8_t last = static_cast<uint8_t>(p[8]);
+    p[8] = static_cast<char>((last & ~hiMask) |
+                             (static_cast<uint8_t>(value >> (64 - shift)) &
+                              hiMask));
+  }
+}
+static uint64_t readBits(const std::vector<char>& buf, size_t bitOffset,
+                         uint8_t bitWidth) {
+  return loadBits(buf.data(), bitOffset, bitWidth);
+}
 static void writeBits(std::vector<char>& buf, size_t bitOffset,
                       uint8_t bitWidth, uint64_t value) {
-  size_t byte0 = bitOffset / 8;
-  size_t byte1 = (bitOffset + bitWidth - 1) / 8;
-  uint8_t shift = bitOffset % 8;
-  uint64_t mask = (bitWidth == 64 ? ~0ull : ((1ull << bitWidth) - 1));
-  for (size_t b = byte0; b <= byte1; ++b) {
-    uint8_t clearMask = ~(((mask << shift) >> ((b - byte0) * 8)) & 0xFF);
-    buf[b] &= clearMask;
+  storeBits(buf.data(), bitOffset, bitWidth, value);
+}
+
+// --- 3a) CRC32C (Castagnoli) ---
+// SSE4.2 の crc32 命令が使えればそれを、なければ slicing-by-8 を使う。
+namespace crc32c_detail {
+constexpr uint32_t kPoly = 0x82F63B78u;  // 反転表現
+
+constexpr std::array<std::array<uint32_t, 256>, 8> makeTables() {
+  std::array<std::array<uint32_t, 256>, 8> t{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (kPoly & (0u - (c & 1u)));
+    t[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; ++i)
+    for (size_t s = 1; s < 8; ++s)
+      t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+  return t;
+}
+inline constexpr auto kTables = makeTables();
+
+inline uint32_t updateSw(uint32_t crc, const uint8_t* p, size_t n) {
+  const auto& t = kTables;
+  while (n >= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    w ^= crc;
+    crc = t[7][w & 0xFF] ^ t[6][(w >> 8) & 0xFF] ^ t[5][(w >> 16) & 0xFF] ^
+          t[4][(w >> 24) & 0xFF] ^ t[3][(w >> 32) & 0xFF] ^
+          t[2][(w >> 40) & 0xFF] ^ t[1][(w >> 48) & 0xFF] ^ t[0][w >> 56];
+    p += 8;
+    n -= 8;
+  }
+  while (n--) crc = t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+#ifdef BINARY_SCHEMA_HAS_CRC32C_HW
+__attribute__((target("sse4.2"))) inline uint32_t updateHw(uint32_t crc,
+                                                           const uint8_t* p,
+                                                           size_t n) {
+  uint64_t c = crc;
+  while (n >= 8) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    c = _mm_crc32_u64(c, w);
+    p += 8;
+    n -= 8;
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  while (n--) c32 = _mm_crc32_u8(c32, *p++);
+  return c32;
+}
+
+// 独立した 4 本のストリームを交互に進め、crc32 命令のレイテンシ (3 サイクル)
+// を隠す。全ストリームの長さは同じ n バイト。
+__attribute__((target("sse4.2"))) inline void updateHw4(
+    const uint8_t* const p[4], size_t n, uint32_t crc[4]) {
+  uint64_t c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w0, w1, w2, w3;
+    std::memcpy(&w0, p[0] + i, 8);
+    std::memcpy(&w1, p[1] + i, 8);
+    std::memcpy(&w2, p[2] + i, 8);
+    std::memcpy(&w3, p[3] + i, 8);
+    c0 = _mm_crc32_u64(c0, w0);
+    c1 = _mm_crc32_u64(c1, w1);
+    c2 = _mm_crc32_u64(c2, w2);
+    c3 = _mm_crc32_u64(c3, w3);
+  }
+  crc[0] = updateHw(static_cast<uint32_t>(c0), p[0] + i, n - i);
+  crc[1] = updateHw(static_cast<uint32_t>(c1), p[1] + i, n - i);
+  crc[2] = updateHw(static_cast<uint32_t>(c2), p[2] + i, n - i);
+  crc[3] = updateHw(static_cast<uint32_t>(c3), p[3] + i, n - i);
+}
+
+inline bool hasHw() {
+  static const bool supported = __builtin_cpu_supports("sse4.2");
+  return supported;
+}
+#else
+inline bool hasHw() { return false; }
+#endif
+}  // namespace crc32c_detail
+
+static uint32_t crc32c(const void* data, size_t n) {
+  auto p = static_cast<const uint8_t*>(data);
+#ifdef BINARY_SCHEMA_HAS_CRC32C_HW
+  if (crc32c_detail::hasHw())
+    return ~crc32c_detail::updateHw(0xFFFFFFFFu, p, n);
+#endif
+  return ~crc32c_detail::updateSw(0xFFFFFFFFu, p, n);
+}
+
+// 4 本同時計算版。ハードウェアがなければ 1 本ずつ計算する。
+static void crc32c4(const uint8_t* const p[4], size_t n, uint32_t out[4]) {
+  uint32_t crc[4] = {0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu};
+#ifdef BINARY_SCHEMA_HAS_CRC32C_HW
+  if (crc32c_detail::hasHw()) {
+    crc32c_detail::updateHw4(p, n, crc);
+    for (int k = 0; k < 4; ++k) out[k] = ~crc[k];
+    return;
+  }
+#endif
+  for (int k = 0; k < 4; ++k)
+    out[k] = ~crc32c_detail::updateSw(crc[k], p[k], n);
+}
+
+// --- 3b) アロケーション計測 ---
+// -DBINARY_SCHEMA_TRACK_ALLOC でビルドすると、グローバルな operator new を
+// 置き換えて、API の種類ごとにヒープ確保の回数とバイト数を数える。
+// 無効時の AllocScope は空で、コストはない。
+enum class AllocCategory : uint8_t {
+  OTHER,
+  SCHEMA,  // loadSchema
+  GET,     // getInteger / getValue (整数)
+  SET,     // setValue (整数)
+  PROXY,   // operator[] と FieldProxy
+  BLOB,    // blob の取得・設定
+  DUMP,    // dump
+  ERROR,   // 例外メッセージの組み立て
+  COUNT
+};
+constexpr size_t kAllocCategories = static_cast<size_t>(AllocCategory::COUNT);
+
+inline const char* allocCategoryName(AllocCategory c) {
+  static constexpr const char* names[] = {"other", "schema", "get",  "set",
+                                          "proxy", "blob",   "dump", "error"};
+  return names[static_cast<size_t>(c)];
+}
+
+struct AllocCounter {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+};
+
+#ifdef BINARY_SCHEMA_TRACK_ALLOC
+inline constexpr bool kAllocTracking = true;
+namespace alloc_detail {
+inline std::array<std::atomic<uint64_t>, kAllocCategories> counts{};
+inline std::array<std::atomic<uint64_t>, kAllocCategories> bytes{};
+inline thread_local AllocCategory current = AllocCategory::OTHER;
+
+inline void record(size_t n) {
+  auto c = static_cast<size_t>(current);
+  counts[c].fetch_add(1, std::memory_order_relaxed);
+  bytes[c].fetch_add(n, std::memory_order_relaxed);
+}
+}  // namespace alloc_detail
+
+// 生存中はこのスレッドの確保を category に数える
+class AllocScope {
+  AllocCategory prev;
+
+ public:
+  explicit AllocScope(AllocCategory c) : prev(alloc_detail::current) {
+    alloc_detail::current = c;
+  }
+  ~AllocScope() { alloc_detail::current = prev; }
+  AllocScope(const AllocScope&) = delete;
+  AllocScope& operator=(const AllocScope&) = delete;
+};
+
+inline std::array<AllocCounter, kAllocCategories> allocStats() {
+  std::array<AllocCounter, kAllocCategories> out;
+  for (size_t i = 0; i < kAllocCategories; ++i)
+    out[i] = {alloc_detail::counts[i].load(std::memory_order_relaxed),
+              alloc_detail::bytes[i].load(std::memory_order_relaxed)};
+  return out;
+}
+inline void resetAllocStats() {
+  for (size_t i = 0; i < kAllocCategories; ++i) {
+    alloc_detail::counts[i].store(0, std::memory_order_relaxed);
+    alloc_detail::bytes[i].store(0, std::memory_order_relaxed);
+  }
+}
+#else
+inline constexpr bool kAllocTracking = false;
+class AllocScope {
+ public:
+  explicit AllocScope(AllocCategory) {}
+};
+inline std::array<AllocCounter, kAllocCategories> allocStats() { return {}; }
+inline void resetAllocStats() {}
+#endif
+
+inline AllocCounter allocTotal() {
+  AllocCounter total;
+  for (const auto& c : allocStats()) {
+    total.count += c.count;
+    total.bytes += c.bytes;
+  }
+  return total;
+}
+
+// 例外を組み立てる経路は呼び出し側 (getInteger などのホットパス) に
+// 展開させず、コールドな関数として外に出す
+[[noreturn, gnu::noinline, gnu::cold]] inline void throwUnknownField(
+    const std::string& name) {
+  AllocScope scope(AllocCategory::ERROR);
+  BS_THROW(std::out_of_range("Unknown field: " + name));
+}
+
+// --- 3c) フィールドアクセスのプロファイル ---
+constexpr size_t kCacheLine = 64;  // 偽共有を避けるための配置単位
+
+// -DBINARY_SCHEMA_PROFILE_FIELDS でビルドすると、スキーマごとにフィールド
+// 単位の読み書き回数を数える。カウンタはスレッドごとのシャードに分けて
+// 競合を避け、集計時に合算する。無効時は空のクラスになる。
+struct FieldAccessCount {
+  std::string name;
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+};
+
+#ifdef BINARY_SCHEMA_PROFILE_FIELDS
+inline constexpr bool kFieldProfiling = true;
+class FieldProfile {
+  static constexpr size_t kShards = 16;
+  struct alignas(kCacheLine) Shard {
+    // [0, n) が読み出し、[n, 2n) が書き込み
+    std::unique_ptr<std::atomic<uint64_t>[]> counters;
+  };
+  size_t n = 0;
+  std::array<Shard, kShards> shards;
+
+  static size_t threadShard() {
+    static std::atomic<size_t> nextShard{0};
+    thread_local size_t shard =
+        nextShard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+  }
+  void bump(size_t slot) {
+    shards[threadShard()].counters[slot].fetch_add(1,
+                                                   std::memory_order_relaxed);
+  }
+
+ public:
+  FieldProfile() = default;
+  // コピーしたスキーマは 0 から数え直す
+  FieldProfile(const FieldProfile& o) { resize(o.n); }
+  FieldProfile& operator=(const FieldProfile& o) {
+    resize(o.n);
+    return *this;
+  }
+
+  void resize(size_t fieldCount) {
+    n = fieldCount;
+    for (auto& s : shards) {
+      s.counters.reset(new std::atomic<uint64_t>[2 * n]);
+      for (size_t i = 0; i < 2 * n; ++i)
+        s.counters[i].store(0, std::memory_order_relaxed);
+    }
+  }
+  void recordRead(size_t idx) { bump(idx); }
+  void recordWrite(size_t idx) { bump(n + idx); }
+
+  std::pair<uint64_t, uint64_t> total(size_t idx) const {
+    uint64_t r = 0, w = 0;
+    for (const auto& s : shards) {
+      r += s.counters[idx].load(std::memory_order_relaxed);
+      w += s.counters[n + idx].load(std::memory_order_relaxed);
+    }
+    return {r, w};
+  }
+  void reset() { resize(n); }
+};
+#else
+inline constexpr bool kFieldProfiling = false;
+class FieldProfile {
+ public:
+  void resize(size_t) {}
+  void recordRead(size_t) {}
+  void recordWrite(size_t) {}
+  std::pair<uint64_t, uint64_t> total(size_t) const { return {0, 0}; }
+  void reset() {}
+};
+#endif
+
+// --- 3d) ステージのトレース ---
+// -DBINARY_SCHEMA_TRACE でビルドすると、TraceScope の区間をスレッドごとの
+// バッファに記録し、終了時に Chrome の trace_event 形式 (chrome://tracing や
+// Perfetto で開ける JSON) で書き出す。出力先は環境変数
+// BINARY_SCHEMA_TRACE_FILE (既定は trace.json)。イベントが 1 つも記録され
+// なかった実行 (引数エラーで終わった場合など) では何も書かない。
+// 無効時の TraceScope は空。
+#ifdef BINARY_SCHEMA_TRACE
+inline constexpr bool kTracing = true;
+namespace trace_detail {
+struct Event {
+  const char* name;  // 文字列リテラルのみ
+  uint64_t beginNs;
+  uint64_t endNs;
+};
+
+// 記録するのは持ち主のスレッドだけで、size の release 書き込みで公開する。
+// 満杯になったら以降のイベントは数えるだけで捨てる。
+struct ThreadBuffer {
+  static constexpr size_t kCapacity = 1 << 16;
+  std::unique_ptr<Event[]> events{new Event[kCapacity]};
+  std::atomic<size_t> size{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<const char*> threadName{nullptr};
+  uint32_t tid = 0;
+  ThreadBuffer* next = nullptr;
+};
+
+// 全スレッドのバッファのリスト。追加は CAS のみで、スレッド終了後も
+// 書き出しまで読めるようにバッファは解放しない。
+inline std::atomic<ThreadBuffer*> buffers{nullptr};
+inline std::atomic<uint32_t> nextTid{1};
+inline const std::chrono::steady_clock::time_point origin =
+    std::chrono::steady_clock::now();
+
+inline uint64_t nowNs() {
+  return static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - origin)
+          .count());
+}
+
+inline ThreadBuffer& local() {
+  thread_local ThreadBuffer* buf = [] {
+    auto* b = new ThreadBuffer;
+    b->tid = nextTid.fetch_add(1, std::memory_order_relaxed);
+    b->next = buffers.load(std::memory_order_relaxed);
+    while (!buffers.compare_exchange_weak(b->next, b,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed))
+      ;
+    return b;
+  }();
+  return *buf;
+}
+
+inline void record(const char* name, uint64_t beginNs, uint64_t endNs) {
+  ThreadBuffer& b = local();
+  size_t n = b.size.load(std::memory_order_relaxed);
+  if (n == ThreadBuffer::kCapacity) {
+    b.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  b.events[n] = {name, beginNs, endNs};
+  b.size.store(n + 1, std::memory_order_release);
+}
+}  // namespace trace_detail
+
+// 生存区間を name の 1 イベント (ph "X") として記録する
+class TraceScope {
+  const char* name;
+  uint64_t begin;
+
+ public:
+  explicit TraceScope(const char* stage)
+      : name(stage), begin(trace_detail::nowNs()) {}
+  ~TraceScope() { trace_detail::record(name, begin, trace_detail::nowNs()); }
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+};
+
+// トレースビューアに表示するスレッド名 (文字列リテラル)
+inline void traceThreadName(const char* name) {
+  trace_detail::local().threadName.store(name, std::memory_order_relaxed);
+}
+
+// それまでに記録されたイベントを書き出す。記録中のスレッドがあっても
+// 公開済みのイベントだけを読むので安全。
+inline void writeTrace(std::ostream& os) {
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  auto sep = [&] {
+    if (!first) os << ",\n";
+    first = false;
+  };
+  uint64_t dropped = 0;
+  for (auto* b = trace_detail::buffers.load(std::memory_order_acquire); b;
+       b = b->next) {
+    if (const char* tn = b->threadName.load(std::memory_order_relaxed)) {
+      sep();
+      os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+         << b->tid << ",\"args\":{\"name\":" << nlohmann::json(tn).dump()
+         << "}}";
+    }
+    size_t n = b->size.load(std::memory_order_acquire);
+    for (size_t i = 0; i < n; ++i) {
+      const trace_detail::Event& e = b->events[i];
+      sep();
+      // ts と dur はマイクロ秒
+      os << "{\"name\":" << nlohmann::json(e.name).dump()
+         << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+         << ",\"ts\":" << static_cast<double>(e.beginNs) / 1e3
+         << ",\"dur\":" << static_cast<double>(e.endNs - e.beginNs) / 1e3
+         << "}";
+    }
+    dropped += b->dropped.load(std::memory_order_relaxed);
+  }
+  os << "],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+}
+
+namespace trace_detail {
+inline bool hasEvents() {
+  for (auto* b = buffers.load(std::memory_order_acquire); b; b = b->next)
+    if (b->size.load(std::memory_order_acquire) ||
+        b->dropped.load(std::memory_order_relaxed))
+      return true;
+  return false;
+}
+
+// 静的オブジェクトの破棄時 (main の終了後) に書き出す
+struct ShutdownWriter {
+  ~ShutdownWriter() {
+    if (!hasEvents()) return;
+    const char* path = std::getenv("BINARY_SCHEMA_TRACE_FILE");
+    std::ofstream ofs(path && *path ? path : "trace.json");
+    if (ofs) writeTrace(ofs);
+  }
+};
+inline ShutdownWriter shutdownWriter;
+}  // namespace trace_detail
+#else
+inline constexpr bool kTracing = false;
+class TraceScope {
+ public:
+  explicit TraceScope(const char*) {}
+};
+inline void traceThreadName(const char*) {}
+inline void writeTrace(std::ostream& os) { os << "{\"traceEvents\":[]}\n"; }
+#endif
+
+// --- 3e) 例外を投げない結果型 ---
+// try* API の戻り値。エラーはコードだけで、メッセージ文字列は作らない。
+enum class StatusCode : uint8_t {
+  OK,
+  UNKNOWN_FIELD,
+  NOT_INTEGER,
+  CHECKSUM_MISMATCH,
+  SHORT_READ,
+  NO_SPACE,
+  BUSY,  // 共有資源 (読み手スロットなど) が空かなかった
+  UNKNOWN_VERSION,
+  WRITE_FAILED  // 出力ストリームへの書き込みが失敗した
+};
+
+inline const char* statusMessage(StatusCode c) {
+  static constexpr const char* names[] = {"ok", "unknown field",
+                                          "not an integer field",
+                                          "checksum mismatch", "short read",
+                                          "buffer too small", "busy",
+                                          "unknown record version",
+                                          "write failed"};
+  return names[static_cast<size_t>(c)];
+}
+
+class [[nodiscard]] Status {
+  StatusCode code = StatusCode::OK;
+
+ public:
+  Status() = default;
+  Status(StatusCode c) : code(c) {}
+  bool ok() const { return code == StatusCode::OK; }
+  explicit operator bool() const { return ok(); }
+  StatusCode error() const { return code; }
+};
+
+// std::expected 風の値またはエラーコード。値は ok() のときだけ有効。
+template <typename T>
+class [[nodiscard]] Result {
+  std::optional<T> val;
+  StatusCode code = StatusCode::OK;
+
+ public:
+  Result(T v) : val(std::move(v)) {}
+  Result(StatusCode c) : code(c) {}
+  bool ok() const { return code == StatusCode::OK; }
+  explicit operator bool() const { return ok(); }
+  StatusCode error() const { return code; }
+  const T& value() const {
+    assert(ok());
+    return *val;
   }
-  uint64_t chunk = (value & mask) << shift;
-  std::memcpy(buf.data() + byte0, &chunk, byte1 - byte0 + 1);
+  const T& operator*() const { return value(); }
+  const T* operator->() const { return &value(); }
+  T value_or(T def) const { return ok() ? *val : def; }
+};
+
+// try* API のエラーを従来の例外に変換する (例外を投げる API 用)
+[[noreturn, gnu::noinline, gnu::cold]] inline void throwStatus(
+    StatusCode c, const std::string& name) {
+  if (c == StatusCode::UNKNOWN_FIELD) throwUnknownField(name);
+  AllocScope scope(AllocCategory::ERROR);
+  if (c == StatusCode::NOT_INTEGER)
+    BS_THROW(std::runtime_error("Field '" + name + "' is not an integer type"));
+  if (c == StatusCode::CHECKSUM_MISMATCH)
+    BS_THROW(std::runtime_error("Checksum mismatch"));
+  if (c == StatusCode::NO_SPACE)
+    BS_THROW(std::out_of_range("Buffer too small for record"));
+  BS_THROW(std::runtime_error(statusMessage(c)));
 }
 
 // --- 4) スキーマクラス ---
+// name2idx を std::string_view で引けるようにする (一時 std::string を
+// 作らない)
+struct FieldNameHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view s) const noexcept {
+    return std::hash<std::string_view>{}(s);
+  }
+};
+
 class BinarySchema {
  public:
   std::vector<FieldDesc> fields;
-  std::unordered_map<std::string, size_t> name2idx;
+  std::unordered_map<std::string, size_t, FieldNameHash, std::equal_to<>>
+      name2idx;
+  std::vector<size_t> checksumFields;  // CRC32C フィールドの添字
   size_t totalSize = 0;
   size_t totalBits = 0;
+  // アクセス回数 (BINARY_SCHEMA_PROFILE_FIELDS 時のみ有効)
+  [[no_unique_address]] mutable FieldProfile profile;
+
+  // フィールドごとの読み書き回数を集計する
+  std::vector<FieldAccessCount> fieldAccessCounts() const {
+    std::vector<FieldAccessCount> out;
+    for (size_t i = 0; i < fields.size(); ++i) {
+      auto [r, w] = profile.total(i);
+      out.push_back({fields[i].name, r, w});
+    }
+    return out;
+  }
+  nlohmann::ordered_json fieldProfileJson() const {
+    nlohmann::ordered_json out = nlohmann::ordered_json::array();
+    for (const auto& c : fieldAccessCounts())
+      out.push_back({{"name", c.name}, {"reads", c.reads}, {"writes", c.writes}});
+    return out;
+  }
+
+  // 名前からフィールド添字を引く (例外を投げない)
+  Result<size_t> findField(std::string_view name) const noexcept {
+    auto it = name2idx.find(name);
+    if (it == name2idx.end()) return StatusCode::UNKNOWN_FIELD;
+    return it->second;
+  }
 
   void loadSchema(const nlohmann::ordered_json& schema) {
+    AllocScope scope(AllocCategory::SCHEMA);
     size_t cursorBits = 0;
     for (auto& item : schema) {
       FieldDesc fd;
@@ -63,34 +700,154 @@ class BinarySchema {
           bitLength > 0 && bitLength <= 64) {
         fd.bitLength = bitLength;
       } else {
-        throw std::runtime_error("Invalid bitLength for field: " + fd.name);
+        BS_THROW(
+            std::runtime_error("Invalid bitLength for field: " + fd.name));
       }
       fd.type = FieldType::BITFIELD;
       fd.bitOffset = cursorBits;
       cursorBits += fd.bitLength;
       fd.size = (fd.bitLength + 7) / 8;
       fd.offset = fd.bitOffset / 8;
+
+      if (item.contains("const")) {
+        fd.hasConst = true;
+        fd.constValue = item["const"].get<uint64_t>();
+        if (fd.bitLength < 64 && (fd.constValue >> fd.bitLength) != 0)
+          BS_THROW(std::runtime_error("Constant does not fit in field: " +
+                                      fd.name));
+      }
+      if (item.contains("default")) {
+        fd.defaultValue = item["default"].get<uint64_t>();
+        if (fd.bitLength < 64 && (fd.defaultValue >> fd.bitLength) != 0)
+          BS_THROW(std::runtime_error("Default does not fit in field: " +
+                                      fd.name));
+      }
+      if (item.contains("checksum")) {
+        const auto& cs = item["checksum"];
+        if (cs["algorithm"].get<std::string>() != "crc32c")
+          BS_THROW(std::runtime_error(
+              "Unsupported checksum algorithm for field: " + fd.name));
+        if (fd.bitLength != 32 || fd.bitOffset % 8 != 0)
+          BS_THROW(std::runtime_error(
+              "Checksum field must be a byte-aligned 32-bit field: " +
+              fd.name));
+        fd.type = FieldType::CRC32C;
+        fd.checksumBegin = cs["begin"].get<size_t>();
+        fd.checksumEnd = cs["end"].get<size_t>();
+        checksumFields.push_back(fields.size());
+      }
       fields.push_back(fd);
     }
     totalBits = cursorBits;
     totalSize = (totalBits + 7) / 8;
+    // 範囲が自分自身や他のチェックサムフィールドにかかると、封をする順序
+    // によって値が決まらない (先に計算した CRC が後から書き換わる) ので拒否する
+    for (size_t idx : checksumFields) {
+      const FieldDesc& fd = fields[idx];
+      bool overlaps = false;
+      for (size_t other : checksumFields) {
+        const FieldDesc& od = fields[other];
+        overlaps |= fd.checksumBegin < od.offset + od.size &&
+                    od.offset < fd.checksumEnd;
+      }
+      if (fd.checksumBegin >= fd.checksumEnd || fd.checksumEnd > totalSize ||
+          overlaps)
+        BS_THROW(std::runtime_error("Invalid checksum range for field: " +
+                                    fd.name));
+    }
     name2idx.reserve(fields.size());
     for (size_t i = 0; i < fields.size(); ++i) {
       name2idx[fields[i].name] = i;
     }
+    profile.resize(fields.size());
   }
 };
 
+// data (totalSize バイト) の全 CRC32C フィールドを計算し直す
+inline void sealChecksumsAt(const BinarySchema& schema, char* data) {
+  for (size_t idx : schema.checksumFields) {
+    const FieldDesc& fd = schema.fields[idx];
+    uint32_t crc =
+        crc32c(data + fd.checksumBegin, fd.checksumEnd - fd.checksumBegin);
+    std::memcpy(data + fd.offset, &crc, 4);
+  }
+}
+
 // --- 5) レコードクラス ---
+// writeDirty が報告する変更済みバイト範囲 [offset, offset + length)
+struct DirtyRange {
+  size_t offset;
+  size_t length;
+};
+
 class DynamicRecord {
   const BinarySchema& schema;
   std::vector<char> buf;
+  std::shared_ptr<const BinarySchema> owner;  // 非 null ならスキーマを延命する
+  // 変更済みバイトのビットマップ。追跡が無効なら空で、書き込み側の
+  // コストは empty() の分岐 1 つだけ。
+  std::vector<uint64_t> dirty;
+
+  void markDirty(size_t firstByte, size_t lastByte) {
+    if (dirty.empty()) return;
+    for (size_t b = firstByte; b <= lastByte; ++b)
+      dirty[b / 64] |= 1ull << (b % 64);
+  }
+  void markField(const FieldDesc& fd) {
+    if (dirty.empty()) return;
+    markDirty(fd.bitOffset / 8, (fd.bitOffset + fd.bitLength - 1) / 8);
+  }
 
  public:
   DynamicRecord(const BinarySchema& s) : schema(s), buf(s.totalSize, 0) {}
+  // レジストリから取得したスキーマ用。レコードが生きている間スキーマを保持する
+  DynamicRecord(std::shared_ptr<const BinarySchema> s)
+      : schema(*s), buf(s->totalSize, 0), owner(std::move(s)) {}
 
-  // 一括読み込み
-  void read(std::istream& is) { is.read(buf.data(), buf.size()); }
+  // 一括読み込み (チェックサムフィールドがあれば検証する)。レコード全体を
+  // 読めなかった場合とチェックサムが合わない場合は例外。
+  void read(std::istream& is) {
+    if (Status st = tryRead(is); !st) throwStatus(st.error(), "");
+  }
+  // 例外を投げない版。レコード全体を読めなければ SHORT_READ を返す。
+  Status tryRead(std::istream& is) {
+    is.read(buf.data(), buf.size());
+    if (!is) return StatusCode::SHORT_READ;
+    clearDirty();
+    if (!verifyChecksums()) return StatusCode::CHECKSUM_MISMATCH;
+    return {};
+  }
+
+  // totalSize バイトのレコードをそのまま取り込む (検証はしない)
+  void assign(const char* bytes) {
+    std::memcpy(buf.data(), bytes, buf.size());
+    if (!buf.empty()) markDirty(0, buf.size() - 1);
+  }
+
+  // 全 CRC32C フィールドを現在のバッファ内容から計算し直す。write() /
+  // writeTo() は出力側にだけ封をするので、getInteger でチェックサム
+  // フィールドの現在値を読みたい場合は先にこれを呼ぶ。
+  void sealChecksums() {
+    for (size_t idx : schema.checksumFields) {
+      const FieldDesc& fd = schema.fields[idx];
+      uint32_t crc = crc32c(buf.data() + fd.checksumBegin,
+                            fd.checksumEnd - fd.checksumBegin);
+      if (!dirty.empty() && std::memcmp(buf.data() + fd.offset, &crc, 4) != 0)
+        markField(fd);
+      std::memcpy(buf.data() + fd.offset, &crc, 4);
+    }
+  }
+  bool verifyChecksums() const {
+    for (size_t idx : schema.checksumFields) {
+      const FieldDesc& fd = schema.fields[idx];
+      uint32_t stored;
+      std::memcpy(&stored, buf.data() + fd.offset, 4);
+      if (stored != crc32c(buf.data() + fd.checksumBegin,
+                           fd.checksumEnd - fd.checksumBegin))
+        return false;
+    }
+    return true;
+  }
 
   // コピー取得
   template <typename T>
@@ -98,9 +855,11 @@ class DynamicRecord {
     static_assert(
         std::is_integral_v<T> || std::is_same_v<T, std::vector<uint8_t>>,
         "T must be integer or blob vector");
+    AllocScope scope(std::is_integral_v<T> ? AllocCategory::GET
+                                           : AllocCategory::BLOB);
     auto it = schema.name2idx.find(name);
-    if (it == schema.name2idx.end())
-      throw std::out_of_range("Unknown field: " + name);
+    if (it == schema.name2idx.end()) throwUnknownField(name);
+    schema.profile.recordRead(it->second);
     const FieldDesc& fd = schema.fields[it->second];
     if constexpr (std::is_integral_v<T>) {
       uint64_t raw = 0;
@@ -118,77 +877,99 @@ class DynamicRecord {
 
   // 汎用整数取得
   uint64_t getInteger(const std::string& name) const {
+    Result<uint64_t> r = tryGetInteger(name);
+    if (!r) throwStatus(r.error(), name);
+    return *r;
+  }
+  // 例外を投げない版
+  Result<uint64_t> tryGetInteger(std::string_view name) const noexcept {
+    AllocScope scope(AllocCategory::GET);
     auto it = schema.name2idx.find(name);
-    if (it == schema.name2idx.end())
-      throw std::out_of_range("Unknown field: " + name);
+    if (it == schema.name2idx.end()) return StatusCode::UNKNOWN_FIELD;
+    schema.profile.recordRead(it->second);
     const FieldDesc& fd = schema.fields[it->second];
-    uint64_t raw;
-    if (fd.type == FieldType::BITFIELD)
-      raw = readBits(buf, fd.bitOffset, fd.bitLength);
-    else
-      switch (fd.type) {
-        case FieldType::UINT8:
-          raw = *reinterpret_cast<const uint8_t*>(buf.data() + fd.offset);
-          break;
-        case FieldType::UINT16:
-          raw = *reinterpret_cast<const uint16_t*>(buf.data() + fd.offset);
-          break;
-        case FieldType::UINT32:
-          raw = *reinterpret_cast<const uint32_t*>(buf.data() + fd.offset);
-          break;
-        case FieldType::INT32:
-          raw = static_cast<int64_t>(
-              *reinterpret_cast<const int32_t*>(buf.data() + fd.offset));
-          break;
-        default:
-          throw std::runtime_error("Field '" + name +
-                                   "' is not an integer type");
+    // 型付きフィールドはバイト境界にしか揃っていないので memcpy で読む
+    const char* p = buf.data() + fd.offset;
+    switch (fd.type) {
+      case FieldType::BITFIELD:
+        return readBits(buf, fd.bitOffset, fd.bitLength);
+      case FieldType::UINT8:
+        return static_cast<uint8_t>(*p);
+      case FieldType::UINT16: {
+        uint16_t v;
+        std::memcpy(&v, p, 2);
+        return v;
       }
-    return raw;
+      case FieldType::UINT32:
+      case FieldType::CRC32C: {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        return v;
+      }
+      case FieldType::INT32: {
+        int32_t v;
+        std::memcpy(&v, p, 4);
+        return static_cast<uint64_t>(static_cast<int64_t>(v));
+      }
+      default:
+        return StatusCode::NOT_INTEGER;
+    }
   }
 
   // 汎用書き込み via uint64_t または blob
   void setValue(const std::string& name, uint64_t value) {
+    if (Status st = trySetValue(name, value); !st)
+      throwStatus(st.error(), name);
+  }
+  // 例外を投げない版
+  Status trySetValue(std::string_view name, uint64_t value) noexcept {
+    AllocScope scope(AllocCategory::SET);
     auto it = schema.name2idx.find(name);
-    if (it == schema.name2idx.end())
-      throw std::out_of_range("Unknown field: " + name);
+    if (it == schema.name2idx.end()) return StatusCode::UNKNOWN_FIELD;
+    schema.profile.recordWrite(it->second);
     const FieldDesc& fd = schema.fields[it->second];
-    if (fd.type == FieldType::BITFIELD)
+    if (fd.type == FieldType::BITFIELD) {
       writeBits(buf, fd.bitOffset, fd.bitLength, value);
-    else
-      switch (fd.type) {
-        case FieldType::UINT8: {
-          uint8_t v = static_cast<uint8_t>(value);
-          std::memcpy(buf.data() + fd.offset, &v, 1);
-        } break;
-        case FieldType::UINT16: {
-          uint16_t v = static_cast<uint16_t>(value);
-          std::memcpy(buf.data() + fd.offset, &v, 2);
-        } break;
-        case FieldType::UINT32: {
-          uint32_t v = static_cast<uint32_t>(value);
-          std::memcpy(buf.data() + fd.offset, &v, 4);
-        } break;
-        case FieldType::INT32: {
-          int32_t v = static_cast<int32_t>(value);
-          std::memcpy(buf.data() + fd.offset, &v, 4);
-        } break;
-        default:
-          throw std::runtime_error("Field '" + name +
-                                   "' is not an integer type");
-      }
+      markField(fd);
+      return {};
+    }
+    switch (fd.type) {
+      case FieldType::UINT8: {
+        uint8_t v = static_cast<uint8_t>(value);
+        std::memcpy(buf.data() + fd.offset, &v, 1);
+      } break;
+      case FieldType::UINT16: {
+        uint16_t v = static_cast<uint16_t>(value);
+        std::memcpy(buf.data() + fd.offset, &v, 2);
+      } break;
+      case FieldType::UINT32:
+      case FieldType::CRC32C: {
+        uint32_t v = static_cast<uint32_t>(value);
+        std::memcpy(buf.data() + fd.offset, &v, 4);
+      } break;
+      case FieldType::INT32: {
+        int32_t v = static_cast<int32_t>(value);
+        std::memcpy(buf.data() + fd.offset, &v, 4);
+      } break;
+      default:
+        return StatusCode::NOT_INTEGER;
+    }
+    markField(fd);
+    return {};
   }
   void setValue(const std::string& name, const std::vector<uint8_t>& data) {
+    AllocScope scope(AllocCategory::BLOB);
     auto it = schema.name2idx.find(name);
-    if (it == schema.name2idx.end())
-      throw std::out_of_range("Unknown field: " + name);
+    if (it == schema.name2idx.end()) throwUnknownField(name);
+    schema.profile.recordWrite(it->second);
     const FieldDesc& fd = schema.fields[it->second];
     if (fd.type != FieldType::BLOB)
-      throw std::runtime_error("Field '" + name + "' is not a blob field");
+      BS_THROW(std::runtime_error("Field '" + name + "' is not a blob field"));
     size_t len = std::min(data.size(), fd.size);
     std::memcpy(buf.data() + fd.offset, data.data(), len);
     if (len < fd.size)
       std::memset(buf.data() + fd.offset + len, 0, fd.size - len);
+    if (fd.size) markDirty(fd.offset, fd.offset + fd.size - 1);
   }
 
   // --- 6) operator[] で get/set ---
@@ -208,13 +989,105 @@ class DynamicRecord {
       return *this;
     }
   };
-  FieldProxy operator[](const std::string& name) { return {this, name}; }
+  FieldProxy operator[](const std::string& name) {
+    AllocScope scope(AllocCategory::PROXY);
+    return {this, name};
+  }
   FieldProxy operator[](const std::string& name) const {
+    AllocScope scope(AllocCategory::PROXY);
     return {const_cast<DynamicRecord*>(this), name};
   }
   // --- 7) バッファをストリームに書き出すメソッド ---
-  void write(std::ostream& os) const { os.write(buf.data(), buf.size()); }
+  // チェックサムフィールドは書き出すバイト列の上で計算され、buf 自体は
+  // 変わらない (buf にも反映するなら sealChecksums())。変更の追跡記録も
+  // 残るので、書き出し済みとして扱うなら clearDirty() を呼ぶ。
+  void write(std::ostream& os) const {
+    if (schema.checksumFields.empty()) {
+      os.write(buf.data(), buf.size());
+      return;
+    }
+    char local[256];
+    std::vector<char> heap;
+    char* p = local;
+    if (buf.size() > sizeof(local)) {
+      heap.resize(buf.size());
+      p = heap.data();
+    }
+    std::memcpy(p, buf.data(), buf.size());
+    sealChecksumsAt(schema, p);
+    os.write(p, buf.size());
+  }
+
+  // ストリームを経由せず dst[offset, offset + totalSize) に書き出す
+  Status tryWriteTo(std::span<std::byte> dst, size_t offset = 0) const {
+    if (offset > dst.size() || dst.size() - offset < buf.size())
+      return StatusCode::NO_SPACE;
+    char* p = reinterpret_cast<char*>(dst.data() + offset);
+    std::memcpy(p, buf.data(), buf.size());
+    sealChecksumsAt(schema, p);
+    return {};
+  }
+  void writeTo(std::span<std::byte> dst, size_t offset = 0) const {
+    if (Status st = tryWriteTo(dst, offset); !st) throwStatus(st.error(), "");
+  }
+
+  // --- 7a) 変更箇所の追跡と部分書き出し ---
+  // 有効にした時点の内容を基準に、以降 set されたバイトを記録する
+  void enableDirtyTracking(bool on = true) {
+    if (on)
+      dirty.assign((buf.size() + 63) / 64, 0);
+    else
+      dirty.clear();
+  }
+  bool dirtyTracking() const { return !dirty.empty(); }
+  void clearDirty() { std::fill(dirty.begin(), dirty.end(), 0); }
+
+  // 変更済みバイトを連続する範囲にまとめて返す
+  std::vector<DirtyRange> dirtyRanges() const {
+    std::vector<DirtyRange> out;
+    for (size_t w = 0; w < dirty.size(); ++w) {
+      uint64_t bits = dirty[w];
+      while (bits) {
+        size_t b = w * 64 + static_cast<size_t>(std::countr_zero(bits));
+        bits &= bits - 1;
+        if (!out.empty() && out.back().offset + out.back().length == b)
+          ++out.back().length;
+        else
+          out.push_back({b, 1});
+      }
+    }
+    return out;
+  }
+
+  // チェックサムを計算し直してから、変更済みの範囲ごとに
+  // emit(offset, const char* bytes, length) を呼び、変更記録を消す。
+  // 追跡が無効なら全体を 1 範囲として渡す。戻り値は渡したバイト数。
+  template <typename Emit>
+  size_t writeDirty(Emit&& emit) {
+    sealChecksums();
+    size_t total = 0;
+    if (dirty.empty()) {
+      emit(size_t{0}, static_cast<const char*>(buf.data()), buf.size());
+      return buf.size();
+    }
+    for (const DirtyRange& r : dirtyRanges()) {
+      emit(r.offset, static_cast<const char*>(buf.data() + r.offset),
+           r.length);
+      total += r.length;
+    }
+    clearDirty();
+    return total;
+  }
+  // ファイル上の recordPos にあるこのレコードを書き換える (シーク可能な
+  // ストリーム用)
+  size_t writeDirty(std::ostream& os, std::streamoff recordPos) {
+    return writeDirty([&](size_t offset, const char* p, size_t len) {
+      os.seekp(recordPos + static_cast<std::streamoff>(offset));
+      os.write(p, static_cast<std::streamsize>(len));
+    });
+  }
   void dump(std::ostream& os) const {
+    AllocScope scope(AllocCategory::DUMP);
     for (auto& byte : buf) {
       os << std::hex << std::setw(2) << std::setfill('0') << (int)(uint8_t)byte
          << ' ';
@@ -223,63 +1096,4820 @@ class DynamicRecord {
   }
 };
 
-// --- 使用例 ---
-int main(int argc, char* argv[]) {
-  if (argc < 2) {
-    std::cerr << "Usage: " << argv[0] << " <schema.json>\n";
-    return 1;
+// --- 8) チェックサム一括検証 ---
+// data に隙間なく並んだ count 個のレコードを検証し、不一致のレコード数を返す。
+// ok が非 null なら各レコードの結果 (1: 一致, 0: 不一致) を書き込む。
+// 4 レコードずつ独立した CRC ストリームとして並行に計算する。
+inline size_t verifyChecksumsBulk(const BinarySchema& schema, const char* data,
+                                  size_t count, uint8_t* ok = nullptr) {
+  const size_t stride = schema.totalSize;
+  auto base = reinterpret_cast<const uint8_t*>(data);
+  std::vector<uint8_t> local;
+  if (!ok) {
+    local.resize(count);
+    ok = local.data();
   }
-  std::ifstream ifs(argv[1]);
-  if (!ifs) {
-    std::cerr << "Error: could not open " << argv[1] << "\n";
-    return 1;
+  std::memset(ok, 1, count);
+  auto fail = [&](size_t rec) { ok[rec] = 0; };
+  for (size_t idx : schema.checksumFields) {
+    const FieldDesc& fd = schema.fields[idx];
+    const size_t len = fd.checksumEnd - fd.checksumBegin;
+    auto stored = [&](size_t rec) {
+      uint32_t v;
+      std::memcpy(&v, base + rec * stride + fd.offset, 4);
+      return v;
+    };
+    size_t r = 0;
+    for (; r + 4 <= count; r += 4) {
+      const uint8_t* p[4];
+      for (int k = 0; k < 4; ++k)
+        p[k] = base + (r + k) * stride + fd.checksumBegin;
+      uint32_t crc[4];
+      crc32c4(p, len, crc);
+      for (int k = 0; k < 4; ++k)
+        if (crc[k] != stored(r + k)) fail(r + k);
+    }
+    for (; r < count; ++r)
+      if (crc32c(base + r * stride + fd.checksumBegin, len) != stored(r))
+        fail(r);
   }
-  nlohmann::json schemaJson;
-  ifs >> schemaJson;
+  return static_cast<size_t>(std::count(ok, ok + count, uint8_t{0}));
+}
 
-  BinarySchema schema;
-  schema.loadSchema(schemaJson);
+// --- 9) 融合デコードカーネル ---
+// 定数フィールド検証・CRC 計算・フィールド抽出を 1 パスで行う。
+// 各レコードのバイト列はフィールド抽出で一度キャッシュに載り、同じ
+// キャッシュラインの上で定数比較と CRC 計算を済ませる。
+enum class RecordStatus : uint8_t { OK, CONST_MISMATCH, CHECKSUM_MISMATCH };
 
-  DynamicRecord rec(schema);
+struct DecodePlan {
+  struct Step {
+    uint32_t byteOffset;  // 読み出し開始バイト
+    uint8_t shift;        // bitOffset % 8
+    uint8_t spanBytes;    // 値がまたがるバイト数 (1..9)
+    bool wide;            // 8 バイトの無条件ロードがレコード内に収まる
+    uint64_t mask;
+  };
+  struct ConstCheck {
+    uint32_t field;
+    uint64_t value;
+  };
+  struct ChecksumStep {
+    uint32_t field;
+    uint32_t offset;  // CRC 格納位置
+    uint32_t begin;
+    uint32_t length;
+  };
+  std::vector<Step> steps;  // フィールド順
+  std::vector<ConstCheck> consts;
+  std::vector<ChecksumStep> checksums;
+  size_t stride = 0;
 
-  constexpr uint8_t VERSION{1};
-  constexpr uint64_t MAGIC{0x123456789abcdeull};
-  constexpr uint32_t LENGTH{0x1357};
-  constexpr uint16_t HEADER_LENGTH{0x48};
-  constexpr uint16_t TYPE{0xab};
+  static DecodePlan compile(const BinarySchema& schema) {
+    DecodePlan plan;
+    plan.stride = schema.totalSize;
+    for (size_t i = 0; i < schema.fields.size(); ++i) {
+      const FieldDesc& fd = schema.fields[i];
+      Step st;
+      st.byteOffset = static_cast<uint32_t>(fd.bitOffset / 8);
+      st.shift = static_cast<uint8_t>(fd.bitOffset % 8);
+      st.spanBytes = static_cast<uint8_t>((st.shift + fd.bitLength + 7) / 8);
+      st.wide = st.spanBytes <= 8 && st.byteOffset + 8 <= plan.stride;
+      st.mask = fd.bitLength == 64 ? ~0ull : ((1ull << fd.bitLength) - 1);
+      plan.steps.push_back(st);
+      if (fd.hasConst)
+        plan.consts.push_back({static_cast<uint32_t>(i), fd.constValue});
+    }
+    for (size_t idx : schema.checksumFields) {
+      const FieldDesc& fd = schema.fields[idx];
+      plan.checksums.push_back({static_cast<uint32_t>(idx),
+                                static_cast<uint32_t>(fd.offset),
+                                static_cast<uint32_t>(fd.checksumBegin),
+                                static_cast<uint32_t>(fd.checksumEnd -
+                                                      fd.checksumBegin)});
+    }
+    return plan;
+  }
 
-  // operator[] を使ってフィールドに値を設定
-  rec["version"] = VERSION;              // 8bit
-  rec["magic"] = MAGIC;                  // 56bit
-  rec["length"] = LENGTH;                // 32bit
-  rec["header_length"] = HEADER_LENGTH;  // 16bit
-  rec["type"] = TYPE;                    // 16bit
+  size_t fieldCount() const { return steps.size(); }
 
-  // バイナリをファイルに書き出し
-  std::ofstream ofs("header.bin", std::ios::binary);
-  if (!ofs) {
-    std::cerr << "Error: could not open header.bin for writing\n";
-    return 1;
+  uint64_t extract(const uint8_t* rec, const Step& st) const {
+    uint64_t w = 0;
+    if (st.wide) {
+      std::memcpy(&w, rec + st.byteOffset, 8);
+      return (w >> st.shift) & st.mask;
+    }
+    if (st.spanBytes <= 8) {
+      std::memcpy(&w, rec + st.byteOffset, st.spanBytes);
+      return (w >> st.shift) & st.mask;
+    }
+    // 64 ビット値が 9 バイトにまたがる場合
+    std::memcpy(&w, rec + st.byteOffset, 8);
+    uint64_t hi = rec[st.byteOffset + 8];
+    return ((w >> st.shift) | (hi << (64 - st.shift))) & st.mask;
   }
-  rec.write(ofs);
-  ofs.close();
-  std::cout << "Header was encoded and written to header.bin\n";
+};
 
-  DynamicRecord rec2(schema);
-  std::ifstream ifs2("header.bin", std::ios::binary);
-  if (!ifs2) {
-    std::cerr << "Error: could not open header.bin for reading\n";
-    return 1;
+// data に並んだ count 個のレコードをデコードする。rows には
+// count * plan.fieldCount() 個の値を行優先で書き込み、status には各レコード
+// の検証結果を書き込む。戻り値は OK だったレコード数。
+inline size_t decodeBatch(const DecodePlan& plan, const char* data,
+                          size_t count, uint64_t* rows, RecordStatus* status) {
+  const size_t nf = plan.fieldCount();
+  auto base = reinterpret_cast<const uint8_t*>(data);
+  size_t okCount = 0;
+  auto decodeOne = [&](size_t r) {
+    const uint8_t* rec = base + r * plan.stride;
+    uint64_t* row = rows + r * nf;
+    for (size_t f = 0; f < nf; ++f) row[f] = plan.extract(rec, plan.steps[f]);
+    RecordStatus st = RecordStatus::OK;
+    for (const auto& c : plan.consts)
+      if (row[c.field] != c.value) st = RecordStatus::CONST_MISMATCH;
+    status[r] = st;
+  };
+  size_t r = 0;
+  // 4 レコード単位: 抽出直後に同じバイト列の CRC を 4 本並行で計算する
+  for (; r + 4 <= count; r += 4) {
+    for (size_t k = 0; k < 4; ++k) decodeOne(r + k);
+    for (const auto& cs : plan.checksums) {
+      const uint8_t* p[4];
+      for (size_t k = 0; k < 4; ++k)
+        p[k] = base + (r + k) * plan.stride + cs.begin;
+      uint32_t crc[4];
+      crc32c4(p, cs.length, crc);
+      for (size_t k = 0; k < 4; ++k)
+        if (status[r + k] == RecordStatus::OK &&
+            crc[k] != rows[(r + k) * nf + cs.field])
+          status[r + k] = RecordStatus::CHECKSUM_MISMATCH;
+    }
   }
-  rec2.read(ifs2);
-  ifs2.close();
-  std::cout << "Header was read and decoded from header.bin\n";
+  for (; r < count; ++r) {
+    decodeOne(r);
+    for (const auto& cs : plan.checksums)
+      if (status[r] == RecordStatus::OK &&
+          crc32c(base + r * plan.stride + cs.begin, cs.length) !=
+              rows[r * nf + cs.field])
+        status[r] = RecordStatus::CHECKSUM_MISMATCH;
+  }
+  for (size_t i = 0; i < count; ++i)
+    if (status[i] == RecordStatus::OK) ++okCount;
+  return okCount;
+}
 
-  // operator[] を使ってフィールドから値を取得
-  std::cout << std::hex;
-  std::cout << "Version:       0x" << rec2["version"] << "\n";
-  std::cout << "Magic:         0x" << rec2["magic"] << "\n";
-  std::cout << "Length:        0x" << rec2["length"] << "\n";
+// --- 9a) レイテンシヒストグラム ---
+// HDR 風の対数線形ヒストグラム。2 のべき乗ごとの区間を 32 個の等幅バケツに
+// 分けるので、相対誤差は約 3% に収まる。記録はバケツ添字の計算と加算のみ。
+class LatencyHistogram {
+ public:
+  static constexpr unsigned kSubBits = 5;
+  static constexpr uint64_t kSub = 1ull << kSubBits;
+  static constexpr size_t kBuckets = (64 - kSubBits + 1) * kSub;
+
+  static size_t bucketOf(uint64_t v) {
+    if (v < kSub) return static_cast<size_t>(v);
+    unsigned e = 63u - static_cast<unsigned>(std::countl_zero(v));
+    return static_cast<size_t>(((e - kSubBits + 1) << kSubBits) +
+                               ((v >> (e - kSubBits)) & (kSub - 1)));
+  }
+  // バケツに入る最大値
+  static uint64_t bucketHigh(size_t b) {
+    if (b < kSub) return b;
+    unsigned group = static_cast<unsigned>(b >> kSubBits);  // 1 以上
+    unsigned e = group + kSubBits - 1;
+    uint64_t lo = (kSub | (b & (kSub - 1))) << (e - kSubBits);
+    return lo + ((1ull << (e - kSubBits)) - 1);
+  }
+
+  void record(uint64_t v) {
+    ++counts[bucketOf(v)];
+    ++n;
+    sum += v;
+    minV = std::min(minV, v);
+    maxV = std::max(maxV, v);
+  }
+  void merge(const LatencyHistogram& o) {
+    for (size_t i = 0; i < kBuckets; ++i) counts[i] += o.counts[i];
+    n += o.n;
+    sum += o.sum;
+    minV = std::min(minV, o.minV);
+    maxV = std::max(maxV, o.maxV);
+  }
+  void reset() { *this = LatencyHistogram(); }
+  void restore(const std::array<uint64_t, kBuckets>& c, uint64_t count,
+               uint64_t total, uint64_t lo, uint64_t hi) {
+    counts = c;
+    n = count;
+    sum = total;
+    minV = lo;
+    maxV = hi;
+  }
+
+  uint64_t count() const { return n; }
+  uint64_t min() const { return n ? minV : 0; }
+  uint64_t max() const { return maxV; }
+  uint64_t total() const { return sum; }
+  double mean() const { return n ? static_cast<double>(sum) / n : 0; }
+  uint64_t bucketCount(size_t b) const { return counts[b]; }
+
+  // q (0..1) 分位点。バケツの上端を返すが、最大値は超えない。
+  uint64_t percentile(double q) const {
+    if (n == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * static_cast<double>(n)));
+    rank = std::clamp<uint64_t>(rank, 1, n);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kBuckets; ++b) {
+      seen += counts[b];
+      if (seen >= rank) return std::min(bucketHigh(b), maxV);
+    }
+    return maxV;
+  }
+
+  void print(std::ostream& os, const std::string& unit = "ns") const {
+    os << "count " << n << ", min " << min() << ", mean " << mean()
+       << ", p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+       << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999)
+       << ", p99.99 " << percentile(0.9999) << ", max " << max() << " "
+       << unit;
+  }
+  nlohmann::ordered_json toJson() const {
+    return {{"count", n},
+            {"min", min()},
+            {"mean", mean()},
+            {"p50", percentile(0.5)},
+            {"p90", percentile(0.9)},
+            {"p99", percentile(0.99)},
+            {"p99.9", percentile(0.999)},
+            {"p99.99", percentile(0.9999)},
+            {"max", max()}};
+  }
+
+ private:
+  std::array<uint64_t, kBuckets> counts{};
+  uint64_t n = 0;
+  uint64_t sum = 0;
+  uint64_t minV = ~0ull;
+  uint64_t maxV = 0;
+};
+
+// 複数スレッドのヒストグラムをロックなしで合算する先。各スレッドは自分の
+// LatencyHistogram に記録し、区切りのよいところで merge() する。
+class SharedLatencyHistogram {
+  std::array<std::atomic<uint64_t>, LatencyHistogram::kBuckets> counts{};
+  std::atomic<uint64_t> n{0}, sum{0}, minV{~0ull}, maxV{0};
+
+ public:
+  void merge(const LatencyHistogram& h) {
+    if (h.count() == 0) return;
+    for (size_t b = 0; b < LatencyHistogram::kBuckets; ++b)
+      if (uint64_t c = h.bucketCount(b))
+        counts[b].fetch_add(c, std::memory_order_relaxed);
+    n.fetch_add(h.count(), std::memory_order_relaxed);
+    sum.fetch_add(h.total(), std::memory_order_relaxed);
+    for (uint64_t cur = minV.load(std::memory_order_relaxed);
+         h.min() < cur && !minV.compare_exchange_weak(
+                              cur, h.min(), std::memory_order_relaxed);)
+      ;
+    for (uint64_t cur = maxV.load(std::memory_order_relaxed);
+         h.max() > cur && !maxV.compare_exchange_weak(
+                              cur, h.max(), std::memory_order_relaxed);)
+      ;
+  }
+  // 合算済みの内容を通常のヒストグラムとして取り出す
+  LatencyHistogram snapshot() const {
+    LatencyHistogram out;
+    std::array<uint64_t, LatencyHistogram::kBuckets> c;
+    for (size_t b = 0; b < c.size(); ++b)
+      c[b] = counts[b].load(std::memory_order_relaxed);
+    out.restore(c, n.load(std::memory_order_relaxed),
+                sum.load(std::memory_order_relaxed),
+                minV.load(std::memory_order_relaxed),
+                maxV.load(std::memory_order_relaxed));
+    return out;
+  }
+};
+
+// --- 10) レコードビューとストリーム読み込み ---
+// 名前引きを済ませたフィールドの位置。同じスキーマのビューでだけ使う。
+struct FieldHandle {
+  size_t index = 0;
+  size_t bitOffset = 0;
+  uint8_t bitLength = 0;
+
+  static Result<FieldHandle> tryOf(const BinarySchema& schema,
+                                   std::string_view name) noexcept {
+    Result<size_t> idx = schema.findField(name);
+    if (!idx) return idx.error();
+    const FieldDesc& fd = schema.fields[*idx];
+    return FieldHandle{*idx, fd.bitOffset, fd.bitLength};
+  }
+  static FieldHandle of(const BinarySchema& schema, const std::string& name) {
+    Result<FieldHandle> h = tryOf(schema, name);
+    if (!h) throwUnknownField(name);
+    return *h;
+  }
+};
+
+// RecordView は外部バッファ上の 1 レコードを指す非所有ビュー
+class RecordView {
+  const BinarySchema* schema;
+  const char* data;
+
+ public:
+  RecordView(const BinarySchema& s, const char* p) : schema(&s), data(p) {}
+
+  const char* bytes() const { return data; }
+  size_t size() const { return schema->totalSize; }
+
+  uint64_t getField(size_t idx) const {
+    schema->profile.recordRead(idx);
+    const FieldDesc& fd = schema->fields[idx];
+    return loadBits(data, fd.bitOffset, fd.bitLength);
+  }
+  uint64_t getInteger(const std::string& name) const {
+    auto it = schema->name2idx.find(name);
+    if (it == schema->name2idx.end()) throwUnknownField(name);
+    return getField(it->second);
+  }
+  Result<uint64_t> tryGetInteger(std::string_view name) const noexcept {
+    Result<size_t> idx = schema->findField(name);
+    if (!idx) return idx.error();
+    return getField(*idx);
+  }
+  uint64_t get(const FieldHandle& h) const {
+    schema->profile.recordRead(h.index);
+    return loadBits(data, h.bitOffset, h.bitLength);
+  }
+};
+
+// 外部バッファ上の 1 レコードに直接書き込むビュー
+class MutableRecordView {
+  const BinarySchema* schema;
+  char* data;
+
+ public:
+  MutableRecordView(const BinarySchema& s, char* p) : schema(&s), data(p) {}
+
+  char* bytes() const { return data; }
+  size_t size() const { return schema->totalSize; }
+  operator RecordView() const { return RecordView(*schema, data); }
+
+  void setField(size_t idx, uint64_t value) {
+    schema->profile.recordWrite(idx);
+    const FieldDesc& fd = schema->fields[idx];
+    storeBits(data, fd.bitOffset, fd.bitLength, value);
+  }
+  void setValue(const std::string& name, uint64_t value) {
+    auto it = schema->name2idx.find(name);
+    if (it == schema->name2idx.end()) throwUnknownField(name);
+    setField(it->second, value);
+  }
+  Status trySetValue(std::string_view name, uint64_t value) noexcept {
+    Result<size_t> idx = schema->findField(name);
+    if (!idx) return idx.error();
+    setField(*idx, value);
+    return {};
+  }
+  void set(const FieldHandle& h, uint64_t value) {
+    schema->profile.recordWrite(h.index);
+    storeBits(data, h.bitOffset, h.bitLength, value);
+  }
+  void sealChecksums() { sealChecksumsAt(*schema, data); }
+};
+
+// 呼び出し側のバッファ (大きなパケットの途中や共有メモリのスロットなど)
+// の dst[offset, offset + totalSize) を直接指すビューを作る。容量はここで
+// 一度だけ検査し、以降のフィールドの読み書きは検査しない。
+inline Status checkCapacity(const BinarySchema& schema, size_t bufferSize,
+                            size_t offset, size_t count = 1) noexcept {
+  if (offset > bufferSize ||
+      (schema.totalSize && (bufferSize - offset) / schema.totalSize < count))
+    return StatusCode::NO_SPACE;
+  return {};
+}
+inline Result<MutableRecordView> tryViewInto(const BinarySchema& schema,
+                                             std::span<std::byte> dst,
+                                             size_t offset = 0) noexcept {
+  if (Status st = checkCapacity(schema, dst.size(), offset); !st)
+    return st.error();
+  return MutableRecordView(schema,
+                           reinterpret_cast<char*>(dst.data()) + offset);
+}
+inline MutableRecordView viewInto(const BinarySchema& schema,
+                                  std::span<std::byte> dst, size_t offset = 0) {
+  Result<MutableRecordView> v = tryViewInto(schema, dst, offset);
+  if (!v) throwStatus(v.error(), "");
+  return *v;
+}
+inline Result<RecordView> tryViewOf(const BinarySchema& schema,
+                                    std::span<const std::byte> src,
+                                    size_t offset = 0) noexcept {
+  if (Status st = checkCapacity(schema, src.size(), offset); !st)
+    return st.error();
+  return RecordView(schema,
+                    reinterpret_cast<const char*>(src.data()) + offset);
+}
+inline RecordView viewOf(const BinarySchema& schema,
+                         std::span<const std::byte> src, size_t offset = 0) {
+  Result<RecordView> v = tryViewOf(schema, src, offset);
+  if (!v) throwStatus(v.error(), "");
+  return *v;
+}
+
+// --- 10a) レコードテンプレート ---
+// const と default の値を詰めたレコードを一度だけ作り、新しいレコードは
+// memcpy 1 回で複製してから変わるフィールドだけを FieldHandle で書く。
+class RecordTemplate {
+  const BinarySchema& schema;
+  std::vector<char> proto;
+
+ public:
+  explicit RecordTemplate(const BinarySchema& s)
+      : schema(s), proto(s.totalSize, 0) {
+    for (const auto& fd : s.fields)
+      storeBits(proto.data(), fd.bitOffset, fd.bitLength,
+                fd.hasConst ? fd.constValue : fd.defaultValue);
+  }
+
+  // テンプレート自体の値を変える (以降に作るレコードに効く)
+  RecordTemplate& set(const std::string& name, uint64_t value) {
+    MutableRecordView(schema, proto.data()).setValue(name, value);
+    return *this;
+  }
+  RecordTemplate& set(const FieldHandle& h, uint64_t value) {
+    MutableRecordView(schema, proto.data()).set(h, value);
+    return *this;
+  }
+  FieldHandle handle(const std::string& name) const {
+    return FieldHandle::of(schema, name);
+  }
+  const BinarySchema& getSchema() const { return schema; }
+  const char* bytes() const { return proto.data(); }
+
+  // dst にテンプレートを複製する。チェックサムは呼び出し側で封をすること。
+  MutableRecordView stamp(char* dst) const {
+    std::memcpy(dst, proto.data(), proto.size());
+    return MutableRecordView(schema, dst);
+  }
+  // 複製して fill(MutableRecordView&) で可変フィールドを書き、封をする
+  template <typename Fill>
+  void stamp(char* dst, Fill&& fill) const {
+    MutableRecordView v = stamp(dst);
+    fill(v);
+    if (!schema.checksumFields.empty()) v.sealChecksums();
+  }
+  // dst[offset, ...) に直接作る。容量の検査は 1 回だけ。
+  template <typename Fill>
+  MutableRecordView stamp(std::span<std::byte> dst, size_t offset,
+                          Fill&& fill) const {
+    MutableRecordView v = viewInto(schema, dst, offset);
+    stamp(v.bytes(), std::forward<Fill>(fill));
+    return v;
+  }
+  DynamicRecord instantiate() const {
+    DynamicRecord rec(schema);
+    rec.assign(proto.data());
+    return rec;
+  }
+
+  // dst に count 個を隙間なく作り、fill(MutableRecordView&, i) を順に呼ぶ。
+  // 複製は書き込み済みの領域を倍々にコピーするので memcpy は log2(count) 回。
+  template <typename Fill>
+  void stampBatch(char* dst, size_t count, Fill&& fill) const {
+    const size_t stride = proto.size();
+    if (count == 0 || stride == 0) return;
+    std::memcpy(dst, proto.data(), stride);
+    for (size_t done = 1; done < count;) {
+      size_t n = std::min(done, count - done);
+      std::memcpy(dst + done * stride, dst, n * stride);
+      done += n;
+    }
+    const bool seal = !schema.checksumFields.empty();
+    for (size_t i = 0; i < count; ++i) {
+      MutableRecordView v(schema, dst + i * stride);
+      fill(v, i);
+      if (seal) v.sealChecksums();
+    }
+  }
+  // count 個分の容量を最初に一度だけ検査する
+  template <typename Fill>
+  void stampBatch(std::span<std::byte> dst, size_t offset, size_t count,
+                  Fill&& fill) const {
+    if (Status st = checkCapacity(schema, dst.size(), offset, count); !st)
+      throwStatus(st.error(), "");
+    stampBatch(reinterpret_cast<char*>(dst.data()) + offset, count,
+               std::forward<Fill>(fill));
+  }
+};
+
+// --- 10b) コンパイル時エンコード ---
+// 値がすべて定数のレコード (ハートビートなど) を constexpr で詰める。
+// スキーマは makeStaticSchema で定数として定義し、encodeStatic<スキーマ>
+// が std::array<std::byte, N> を返す。名前の誤りや範囲外の値は定数評価の
+// 失敗、つまりコンパイルエラーになる。チェックサムフィールドは扱わない。
+constexpr void packBits(std::byte* p, size_t bitOffset, unsigned width,
+                        uint64_t value) {
+  for (unsigned i = 0; i < width;) {
+    const size_t bit = bitOffset + i;
+    const unsigned shift = bit % 8;
+    const unsigned n = std::min(8u - shift, width - i);
+    const auto mask = static_cast<uint8_t>(((1u << n) - 1) << shift);
+    const auto old = std::to_integer<uint8_t>(p[bit / 8]);
+    const auto bits = static_cast<uint8_t>((value >> i) << shift);
+    p[bit / 8] = std::byte(static_cast<uint8_t>((old & ~mask) | (bits & mask)));
+    i += n;
+  }
+}
+constexpr uint64_t unpackBits(const std::byte* p, size_t bitOffset,
+                              unsigned width) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < width;) {
+    const size_t bit = bitOffset + i;
+    const unsigned shift = bit % 8;
+    const unsigned n = std::min(8u - shift, width - i);
+    const uint64_t b = std::to_integer<uint8_t>(p[bit / 8]) >> shift;
+    v |= (b & ((1u << n) - 1)) << i;
+    i += n;
+  }
+  return v;
+}
+
+struct StaticField {
+  std::string_view name;
+  uint8_t bitLength = 0;
+  bool hasConst = false;
+  uint64_t constValue = 0;
+  size_t bitOffset = 0;  // makeStaticSchema が埋める
+};
+
+template <size_t NF>
+struct StaticSchema {
+  std::array<StaticField, NF> fields{};
+  size_t totalBits = 0;
+
+  constexpr size_t totalSize() const { return (totalBits + 7) / 8; }
+  constexpr size_t indexOf(std::string_view name) const {
+    for (size_t i = 0; i < NF; ++i)
+      if (fields[i].name == name) return i;
+    BS_THROW(std::out_of_range("Unknown field in static schema"));
+  }
+  // 実行時の BinarySchema::loadSchema に渡せる JSON
+  nlohmann::ordered_json toJson() const {
+    nlohmann::ordered_json out = nlohmann::ordered_json::array();
+    for (const auto& f : fields) {
+      nlohmann::ordered_json j = {{"name", std::string(f.name)},
+                                  {"bitLength", f.bitLength}};
+      if (f.hasConst) j["const"] = f.constValue;
+      out.push_back(std::move(j));
+    }
+    return out;
+  }
+};
+
+template <size_t NF>
+consteval StaticSchema<NF> makeStaticSchema(const StaticField (&fields)[NF]) {
+  StaticSchema<NF> s;
+  for (size_t i = 0; i < NF; ++i) {
+    StaticField f = fields[i];
+    if (f.bitLength == 0 || f.bitLength > 64)
+      BS_THROW(std::runtime_error("Invalid bitLength in static schema"));
+    if (f.hasConst && f.bitLength < 64 && (f.constValue >> f.bitLength) != 0)
+      BS_THROW(std::runtime_error("Constant does not fit in static field"));
+    f.bitOffset = s.totalBits;
+    s.totalBits += f.bitLength;
+    s.fields[i] = f;
+  }
+  return s;
+}
+
+struct StaticValue {
+  std::string_view name;
+  uint64_t value;
+};
+
+// 指定のないフィールドは const の値か 0 になる
+template <const auto& Schema>
+constexpr std::array<std::byte, Schema.totalSize()> encodeStatic(
+    std::initializer_list<StaticValue> values) {
+  std::array<std::byte, Schema.totalSize()> out{};
+  for (const auto& f : Schema.fields)
+    if (f.hasConst) packBits(out.data(), f.bitOffset, f.bitLength, f.constValue);
+  for (const auto& v : values) {
+    const StaticField& f = Schema.fields[Schema.indexOf(v.name)];
+    if (f.bitLength < 64 && (v.value >> f.bitLength) != 0)
+      BS_THROW(std::out_of_range("Value does not fit in static field"));
+    if (f.hasConst && v.value != f.constValue)
+      BS_THROW(std::out_of_range("Value differs from the field's constant"));
+    packBits(out.data(), f.bitOffset, f.bitLength, v.value);
+  }
+  return out;
+}
+template <const auto& Schema, size_t N>
+constexpr uint64_t decodeStatic(const std::array<std::byte, N>& bytes,
+                                std::string_view name) {
+  static_assert(N == Schema.totalSize(), "record size does not match schema");
+  const StaticField& f = Schema.fields[Schema.indexOf(name)];
+  return unpackBits(bytes.data(), f.bitOffset, f.bitLength);
+}
+
+// 例: trigger_time_header.json と同じ配置のハートビートフレーム
+inline constexpr auto kTriggerTimeHeader = makeStaticSchema({
+    {"version", 8},
+    {"magic", 56, true, 0x123456789abcdeull},
+    {"length", 32},
+    {"header_length", 16},
+    {"type", 16},
+});
+inline constexpr auto kHeartbeatFrame = encodeStatic<kTriggerTimeHeader>({
+    {"version", 1},
+    {"length", 16},
+    {"header_length", 16},
+    {"type", 0xfe},
+});
+static_assert(kHeartbeatFrame ==
+              std::array<std::byte, 16>{
+                  std::byte{0x01}, std::byte{0xde}, std::byte{0xbc},
+                  std::byte{0x9a}, std::byte{0x78}, std::byte{0x56},
+                  std::byte{0x34}, std::byte{0x12}, std::byte{0x10},
+                  std::byte{0x00}, std::byte{0x00}, std::byte{0x00},
+                  std::byte{0x10}, std::byte{0x00}, std::byte{0xfe},
+                  std::byte{0x00}});
+static_assert(decodeStatic<kTriggerTimeHeader>(kHeartbeatFrame, "magic") ==
+              0x123456789abcdeull);
+
+// 固定長レコードをまとめて読み込むリーダー
+class RecordStreamReader {
+  std::istream& is;
+  const BinarySchema& schema;
+  LatencyHistogram* readLatency = nullptr;
+
+ public:
+  RecordStreamReader(std::istream& in, const BinarySchema& s)
+      : is(in), schema(s) {}
+
+  const BinarySchema& getSchema() const { return schema; }
+
+  // 設定すると readBatch 1 回ごとの所要時間 (ns) を記録する
+  void setReadLatency(LatencyHistogram* h) { readLatency = h; }
+
+  // 最大 maxRecords 個を dst に読み込み、完全に読めたレコード数を返す。
+  // 末尾の不完全なレコードは捨てる。
+  size_t readBatch(char* dst, size_t maxRecords) {
+    TraceScope trace("read");
+    auto t0 = readLatency ? std::chrono::steady_clock::now()
+                          : std::chrono::steady_clock::time_point{};
+    is.read(dst, static_cast<std::streamsize>(maxRecords * schema.totalSize));
+    if (readLatency)
+      readLatency->record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - t0)
+              .count()));
+    return static_cast<size_t>(is.gcount()) / schema.totalSize;
+  }
+};
+
+// --- 11) SPSC リングとパイプライン ---
+
+// BUSY_POLL は待つ側がコアを回し続けるので、生産者と消費者にそれぞれ
+// 専用のコアがあるときだけ速い。コアを共有すると相手の実行を妨げるため、
+// 一定回数回っても進まなければ yield で譲る。
+enum class WaitMode : uint8_t { BUSY_POLL, FUTEX_WAIT };
+
+// 単一生産者・単一消費者のロックフリーリング。スロットはその場で読み書きし、
+// インデックスは publishBatch 個ごとにまとめて公開する。FUTEX_WAIT では
+// std::atomic::wait (Linux では futex) で相手を待つ。
+template <typename T>
+class SpscRing {
+  struct alignas(kCacheLine) Index {
+    std::atomic<uint64_t> value{0};
+    std::atomic<uint32_t> signal{0};  // wait/notify 用
+  };
+
+  std::vector<T> slots;
+  const uint64_t mask;
+  const uint32_t publishBatch;
+  const WaitMode mode;
+
+  Index head;  // 生産者が書く
+  Index tail;  // 消費者が書く
+  std::atomic<bool> closed{false};
+
+  // 生産者側ローカル状態
+  alignas(kCacheLine) uint64_t prodHead = 0;
+  uint64_t prodTailCache = 0;
+  // 消費者側ローカル状態
+  alignas(kCacheLine) uint64_t consTail = 0;
+  uint64_t consHeadCache = 0;
+
+  static void publish(Index& idx, uint64_t v, WaitMode m) {
+    idx.value.store(v, std::memory_order_release);
+    if (m == WaitMode::FUTEX_WAIT) {
+      idx.signal.fetch_add(1, std::memory_order_release);
+      idx.signal.notify_one();
+    }
+  }
+  static constexpr unsigned kSpinsBeforeYield = 1024;
+
+  // idx.value が pred を満たすまで待つ (close 後は即座に戻る)
+  template <typename Pred>
+  bool await(Index& idx, Pred pred) {
+    for (unsigned spins = 0;; ++spins) {
+      uint32_t sig = idx.signal.load(std::memory_order_acquire);
+      if (pred(idx.value.load(std::memory_order_acquire))) return true;
+      if (closed.load(std::memory_order_acquire))
+        return pred(idx.value.load(std::memory_order_acquire));
+      if (mode == WaitMode::FUTEX_WAIT) {
+        idx.signal.wait(sig, std::memory_order_acquire);
+      } else if (spins >= kSpinsBeforeYield) {
+        std::this_thread::yield();
+      } else {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+      }
+    }
+  }
+
+ public:
+  SpscRing(size_t capacity, WaitMode m, uint32_t batch = 4)
+      : slots(std::bit_ceil(capacity)),
+        mask(std::bit_ceil(capacity) - 1),
+        publishBatch(std::max<uint32_t>(1, batch)),
+        mode(m) {}
+
+  // --- 生産者 ---
+  // 書き込み可能なスロットを返す。満杯なら空くまで待つ。
+  T& claim() {
+    if (prodHead - prodTailCache > mask) {
+      await(tail, [&](uint64_t t) { return prodHead - t <= mask; });
+      prodTailCache = tail.value.load(std::memory_order_acquire);
+    }
+    return slots[prodHead & mask];
+  }
+  void commit() {
+    ++prodHead;
+    if (prodHead - head.value.load(std::memory_order_relaxed) >=
+            publishBatch ||
+        prodHead - prodTailCache > mask)
+      publish(head, prodHead, mode);
+  }
+  void flush() { publish(head, prodHead, mode); }
+  // 生産終了。未公開分を公開して消費者を起こす。
+  void close() {
+    flush();
+    closed.store(true, std::memory_order_release);
+    if (mode == WaitMode::FUTEX_WAIT) {
+      head.signal.fetch_add(1, std::memory_order_release);
+      head.signal.notify_all();
+    }
+  }
+
+  // --- 消費者 ---
+  // 次のスロットを返す。close 済みで空なら nullptr。
+  T* front() {
+    if (consTail == consHeadCache) {
+      if (!await(head, [&](uint64_t h) { return h != consTail; }))
+        return nullptr;
+      consHeadCache = head.value.load(std::memory_order_acquire);
+    }
+    return &slots[consTail & mask];
+  }
+  void pop() {
+    ++consTail;
+    if (consTail - tail.value.load(std::memory_order_relaxed) >=
+            publishBatch ||
+        consTail == consHeadCache)
+      publish(tail, consTail, mode);
+  }
+};
+
+// リングのスロット 1 つ分のレコードバッチ
+struct RecordBatch {
+  std::vector<char> bytes;
+  size_t count = 0;
+  std::chrono::steady_clock::time_point readAt;
+};
+
+struct PipelineStats {
+  size_t records = 0;
+  size_t batches = 0;
+  double seconds = 0;
+  LatencyHistogram readLatency;   // readBatch 1 回の時間 (ns)
+  LatencyHistogram batchLatency;  // バッチ読み込み完了からデコード完了まで
+  LatencyHistogram decodeLatency;  // 1 レコードのデコード (perRecordTiming 時)
+};
+
+// 読み込みスレッドとデコードスレッドを SPSC リングでつなぐ。
+// 読み込みは呼び出しスレッドで行い、decode は別スレッドで各レコードに対して
+// 呼ばれる。
+inline PipelineStats runPipeline(
+    RecordStreamReader& reader,
+    const std::function<void(const RecordView&)>& decode,
+    size_t batchRecords = 256, size_t ringSlots = 64,
+    WaitMode mode = WaitMode::BUSY_POLL, bool perRecordTiming = false) {
+  const BinarySchema& schema = reader.getSchema();
+  SpscRing<RecordBatch> ring(ringSlots, mode);
+  PipelineStats stats;
+  auto ns = [](auto d) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  std::thread consumer([&] {
+    traceThreadName("decoder");
+    // デコードスレッド専用のヒストグラム。join 後に stats へ渡す。
+    LatencyHistogram batchLatency, decodeLatency;
+    while (RecordBatch* b = ring.front()) {
+      TraceScope trace("decode");
+      for (size_t i = 0; i < b->count; ++i) {
+        RecordView v(schema, b->bytes.data() + i * schema.totalSize);
+        if (perRecordTiming) {
+          auto t0 = std::chrono::steady_clock::now();
+          decode(v);
+          decodeLatency.record(ns(std::chrono::steady_clock::now() - t0));
+        } else {
+          decode(v);
+        }
+      }
+      batchLatency.record(ns(std::chrono::steady_clock::now() - b->readAt));
+      ring.pop();
+    }
+    stats.batchLatency = batchLatency;
+    stats.decodeLatency = decodeLatency;
+  });
+
+  traceThreadName("reader");
+  reader.setReadLatency(&stats.readLatency);
+  for (;;) {
+    RecordBatch& b = ring.claim();
+    b.bytes.resize(batchRecords * schema.totalSize);
+    b.count = reader.readBatch(b.bytes.data(), batchRecords);
+    if (b.count == 0) break;
+    b.readAt = std::chrono::steady_clock::now();
+    stats.records += b.count;
+    ++stats.batches;
+    ring.commit();
+  }
+  ring.close();
+  consumer.join();
+  reader.setReadLatency(nullptr);
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  return stats;
+}
+
+// --- 12) ワークスティーリング実行器 ---
+// Chase–Lev 両端キュー: 所有スレッドは bottom 側で push/take し、
+// 他スレッドは top 側から steal する。
+template <typename T>
+class ChaseLevDeque {
+  struct Array {
+    int64_t capacity;
+    std::unique_ptr<std::atomic<T*>[]> items;
+    explicit Array(int64_t cap)
+        : capacity(cap), items(new std::atomic<T*>[static_cast<size_t>(cap)]) {}
+    T* get(int64_t i) const {
+      return items[static_cast<size_t>(i & (capacity - 1))].load(
+          std::memory_order_relaxed);
+    }
+    void put(int64_t i, T* x) {
+      items[static_cast<size_t>(i & (capacity - 1))].store(
+          x, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(kCacheLine) std::atomic<int64_t> top{0};
+  alignas(kCacheLine) std::atomic<int64_t> bottom{0};
+  std::atomic<Array*> array;
+  std::vector<std::unique_ptr<Array>> arrays;  // 旧配列は破棄まで保持する
+
+ public:
+  explicit ChaseLevDeque(int64_t capacity = 256) {
+    arrays.emplace_back(new Array(capacity));
+    array.store(arrays.back().get(), std::memory_order_relaxed);
+  }
+
+  void push(T* x) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array* a = array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+      auto bigger = std::make_unique<Array>(a->capacity * 2);
+      for (int64_t i = t; i < b; ++i) bigger->put(i, a->get(i));
+      a = bigger.get();
+      arrays.push_back(std::move(bigger));
+      array.store(a, std::memory_order_release);
+    }
+    a->put(b, x);
+    bottom.store(b + 1, std::memory_order_release);
+  }
+
+  T* take() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* x = a->get(b);
+    if (t == b) {
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        x = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return x;
+  }
+
+  T* steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Array* a = array.load(std::memory_order_acquire);
+    T* x = a->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+    return x;
+  }
+};
+
+// レコード範囲タスクを実行するワークスティーリングスレッドプール。
+// 範囲は実行時に grain 以下になるまで二分され、後半が自分のキューに積まれる
+// ので、盗んだ側も同じように分割を続けられる。
+class WorkStealingPool {
+  struct Job {
+    const std::function<void(size_t, size_t)>* fn;
+    size_t grain;
+    std::atomic<size_t> remaining;  // 未処理の要素数
+    // fn が最初に投げた例外。以降の区間では fn を呼ばずに数だけ減らし、
+    // remaining が 0 になってから parallelFor の呼び出し元で投げ直す。
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+  };
+  struct RangeTask {
+    Job* job;
+    size_t begin, end;
+  };
+  struct alignas(kCacheLine) Worker {
+    ChaseLevDeque<RangeTask> deque;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  std::mutex injectMutex;
+  std::deque<RangeTask*> injected;  // 外部スレッドから投入されたタスク
+  std::atomic<uint32_t> epoch{0};   // 新しい仕事の通知用
+  std::atomic<uint32_t> sleepers{0};
+  // ジョブ完了の通知用。Job は待ち手のスタック上にあり完了直後に破棄され
+  // うるので、通知はプール側のカウンタで行う。
+  std::atomic<uint32_t> completions{0};
+  std::atomic<bool> stopping{false};
+
+  static thread_local WorkStealingPool* currentPool;
+  static thread_local size_t currentIndex;
+
+  // 眠る側 (sleepers を増やしてから epoch を読む) と起こす側 (epoch を
+  // 進めてから sleepers を読む) は別々の変数への書き込みと読み出しが交差
+  // するので、acquire/release では両方が古い値を見うる。全順序を付ける
+  // ため 4 つの操作はすべて seq_cst にする。
+  void wake() {
+    epoch.fetch_add(1, std::memory_order_seq_cst);
+    if (sleepers.load(std::memory_order_seq_cst) > 0) epoch.notify_all();
+  }
+
+  void execute(size_t self, RangeTask* task) {
+    Job* job = task->job;
+    size_t begin = task->begin, end = task->end;
+    delete task;
+    // 後半を積みながら前半へ降りていく
+    while (end - begin > job->grain) {
+      size_t mid = begin + (end - begin) / 2;
+      workers[self]->deque.push(new RangeTask{job, mid, end});
+      // 起こすかどうかの目安だけ。見逃しても積んだ区間は自分が後で処理する
+      if (sleepers.load(std::memory_order_relaxed) > 0) wake();
+      end = mid;
+    }
+    if (!job->failed.load(std::memory_order_relaxed)) {
+#if BINARY_SCHEMA_EXCEPTIONS
+      try {
+        (*job->fn)(begin, end);
+      } catch (...) {
+        if (!job->failed.exchange(true, std::memory_order_relaxed))
+          job->error = std::current_exception();
+      }
+#else
+      (*job->fn)(begin, end);
+#endif
+    }
+    if (job->remaining.fetch_sub(end - begin, std::memory_order_acq_rel) ==
+        end - begin) {
+      completions.fetch_add(1, std::memory_order_release);
+      completions.notify_all();
+    }
+  }
+
+  RangeTask* findTask(size_t self, uint64_t& rng) {
+    if (RangeTask* t = workers[self]->deque.take()) return t;
+    const size_t n = workers.size();
+    for (size_t attempt = 0; attempt < n; ++attempt) {
+      rng ^= rng << 13;
+      rng ^= rng >> 7;
+      rng ^= rng << 17;
+      size_t victim = rng % n;
+      if (victim == self) continue;
+      if (RangeTask* t = workers[victim]->deque.steal()) return t;
+    }
+    std::lock_guard<std::mutex> lk(injectMutex);
+    if (injected.empty()) return nullptr;
+    RangeTask* t = injected.front();
+    injected.pop_front();
+    return t;
+  }
+
+  void workerLoop(size_t self) {
+    currentPool = this;
+    currentIndex = self;
+    traceThreadName("worker");
+    uint64_t rng = 0x9E3779B97F4A7C15ull * (self + 1);
+    while (!stopping.load(std::memory_order_acquire)) {
+      uint32_t seen = epoch.load(std::memory_order_acquire);
+      if (RangeTask* t = findTask(self, rng)) {
+        execute(self, t);
+        continue;
+      }
+      sleepers.fetch_add(1, std::memory_order_seq_cst);
+      if (epoch.load(std::memory_order_seq_cst) == seen &&
+          !stopping.load(std::memory_order_acquire))
+        epoch.wait(seen, std::memory_order_acquire);
+      sleepers.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  // [begin, end) を投入し、job の全区間が終わるまで待つ
+  void waitJob(Job& job, size_t begin, size_t end) {
+    auto* root = new RangeTask{&job, begin, end};
+    if (currentPool == this) {
+      size_t self = currentIndex;
+      uint64_t rng = 0xD1B54A32D192ED03ull * (self + 1);
+      workers[self]->deque.push(root);
+      wake();
+      // 手伝える仕事がない間は他のワーカーが区間を終えるのを待つだけなので、
+      // 空振りが続いたら譲る
+      for (unsigned misses = 0;
+           job.remaining.load(std::memory_order_acquire) != 0;) {
+        if (RangeTask* t = findTask(self, rng)) {
+          execute(self, t);
+          misses = 0;
+        } else if (++misses >= 64) {
+          std::this_thread::yield();
+        }
+      }
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(injectMutex);
+      injected.push_back(root);
+    }
+    wake();
+    for (;;) {
+      uint32_t c = completions.load(std::memory_order_acquire);
+      if (job.remaining.load(std::memory_order_acquire) == 0) break;
+      completions.wait(c, std::memory_order_acquire);
+    }
+  }
+
+ public:
+  explicit WorkStealingPool(size_t nThreads = 0) {
+    if (nThreads == 0)
+      nThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < nThreads; ++i)
+      workers.push_back(std::make_unique<Worker>());
+    for (size_t i = 0; i < nThreads; ++i)
+      threads.emplace_back([this, i] { workerLoop(i); });
+  }
+  ~WorkStealingPool() {
+    stopping.store(true, std::memory_order_release);
+    epoch.fetch_add(1, std::memory_order_release);
+    epoch.notify_all();
+    for (auto& t : threads) t.join();
+  }
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  size_t size() const { return workers.size(); }
+
+  // ライブラリの並列演算が共有するプール
+  static WorkStealingPool& shared() {
+    static WorkStealingPool pool;
+    return pool;
+  }
+
+  // [begin, end) を grain 以下の区間に分けて fn(b, e) を並列に呼び、
+  // すべて終わるまで待つ。ワーカーから呼ばれた場合は待つ間も仕事を手伝う。
+  // fn が例外を投げた場合は、全区間の片付けを待ってから最初の例外を
+  // 投げ直す (残りの区間の fn は呼ばれないことがある)。
+  void parallelFor(size_t begin, size_t end, size_t grain,
+                   const std::function<void(size_t, size_t)>& fn) {
+    if (begin >= end) return;
+    Job job{&fn, std::max<size_t>(1, grain), {end - begin}, {false}, nullptr};
+    waitJob(job, begin, end);
+#if BINARY_SCHEMA_EXCEPTIONS
+    if (job.error) std::rethrow_exception(job.error);
+#endif
+  }
+};
+inline thread_local WorkStealingPool* WorkStealingPool::currentPool = nullptr;
+inline thread_local size_t WorkStealingPool::currentIndex = 0;
+
+// --- 13) 並列演算 ---
+// いずれも WorkStealingPool::shared() 上で動き、呼び出しごとにスレッドを
+// 作らない。
+constexpr size_t kParallelGrain = 4096;  // 1 タスクあたりの最小レコード数
+
+inline size_t parallelDecodeBatch(const DecodePlan& plan, const char* data,
+                                  size_t count, uint64_t* rows,
+                                  RecordStatus* status,
+                                  WorkStealingPool& pool =
+                                      WorkStealingPool::shared()) {
+  std::atomic<size_t> ok{0};
+  const size_t nf = plan.fieldCount();
+  pool.parallelFor(0, count, kParallelGrain, [&](size_t b, size_t e) {
+    TraceScope trace("decode");
+    ok.fetch_add(decodeBatch(plan, data + b * plan.stride, e - b,
+                             rows + b * nf, status + b),
+                 std::memory_order_relaxed);
+  });
+  return ok.load();
+}
+
+inline size_t parallelVerifyChecksums(const BinarySchema& schema,
+                                      const char* data, size_t count,
+                                      uint8_t* ok,
+                                      WorkStealingPool& pool =
+                                          WorkStealingPool::shared()) {
+  std::atomic<size_t> failures{0};
+  pool.parallelFor(0, count, kParallelGrain, [&](size_t b, size_t e) {
+    TraceScope trace("verify");
+    failures.fetch_add(verifyChecksumsBulk(schema,
+                                           data + b * schema.totalSize, e - b,
+                                           ok + b),
+                       std::memory_order_relaxed);
+  });
+  return failures.load();
+}
+
+// pred を満たすレコードの添字を昇順で返す
+inline std::vector<size_t> parallelFilter(
+    const BinarySchema& schema, const char* data, size_t count,
+    const std::function<bool(const RecordView&)>& pred,
+    WorkStealingPool& pool = WorkStealingPool::shared()) {
+  std::mutex mu;
+  std::vector<std::pair<size_t, std::vector<size_t>>> parts;
+  pool.parallelFor(0, count, kParallelGrain, [&](size_t b, size_t e) {
+    TraceScope trace("filter");
+    std::vector<size_t> hits;
+    for (size_t i = b; i < e; ++i)
+      if (pred(RecordView(schema, data + i * schema.totalSize)))
+        hits.push_back(i);
+    std::lock_guard<std::mutex> lk(mu);
+    parts.emplace_back(b, std::move(hits));
+  });
+  std::sort(parts.begin(), parts.end(),
+            [](const auto& x, const auto& y) { return x.first < y.first; });
+  std::vector<size_t> result;
+  for (auto& p : parts) result.insert(result.end(), p.second.begin(),
+                                      p.second.end());
+  return result;
+}
+
+struct FieldAggregate {
+  size_t count = 0;
+  uint64_t sum = 0;  // 2^64 を法とする
+  uint64_t min = ~0ull;
+  uint64_t max = 0;
+
+  void add(uint64_t v) {
+    ++count;
+    sum += v;
+    min = std::min(min, v);
+    max = std::max(max, v);
+  }
+  void merge(const FieldAggregate& o) {
+    count += o.count;
+    sum += o.sum;
+    min = std::min(min, o.min);
+    max = std::max(max, o.max);
+  }
+};
+
+inline FieldAggregate parallelAggregate(const BinarySchema& schema,
+                                        const char* data, size_t count,
+                                        size_t fieldIdx,
+                                        WorkStealingPool& pool =
+                                            WorkStealingPool::shared()) {
+  std::mutex mu;
+  FieldAggregate total;
+  pool.parallelFor(0, count, kParallelGrain, [&](size_t b, size_t e) {
+    TraceScope trace("aggregate");
+    FieldAggregate local;
+    for (size_t i = b; i < e; ++i)
+      local.add(RecordView(schema, data + i * schema.totalSize)
+                    .getField(fieldIdx));
+    std::lock_guard<std::mutex> lk(mu);
+    total.merge(local);
+  });
+  return total;
+}
+
+// 1 レコードを JSON オブジェクトとして out に追記する。keys は
+// recordJsonKeys() で作ったフィールドごとの "\"name\":" 文字列。
+inline std::vector<std::string> recordJsonKeys(const BinarySchema& schema) {
+  std::vector<std::string> keys;
+  for (const auto& fd : schema.fields)
+    keys.push_back(nlohmann::json(fd.name).dump() + ":");
+  return keys;
+}
+inline void appendRecordJson(const RecordView& v,
+                             const std::vector<std::string>& keys,
+                             std::string& out) {
+  out += '{';
+  char num[24];
+  for (size_t f = 0; f < keys.size(); ++f) {
+    if (f) out += ',';
+    out += keys[f];
+    auto res = std::to_chars(num, num + sizeof(num), v.getField(f));
+    out.append(num, res.ptr);
+  }
+  out += '}';
+}
+
+// レコードを 1 行 1 オブジェクト (JSON Lines) で書き出した文字列を返す
+inline std::string parallelExportJson(const BinarySchema& schema,
+                                      const char* data, size_t count,
+                                      WorkStealingPool& pool =
+                                          WorkStealingPool::shared()) {
+  const auto keys = recordJsonKeys(schema);
+  std::mutex mu;
+  std::vector<std::pair<size_t, std::string>> parts;
+  pool.parallelFor(0, count, kParallelGrain, [&](size_t b, size_t e) {
+    TraceScope trace("export");
+    std::string local;
+    for (size_t i = b; i < e; ++i) {
+      appendRecordJson(RecordView(schema, data + i * schema.totalSize), keys,
+                       local);
+      local += '\n';
+    }
+    std::lock_guard<std::mutex> lk(mu);
+    parts.emplace_back(b, std::move(local));
+  });
+  std::sort(parts.begin(), parts.end(),
+            [](const auto& x, const auto& y) { return x.first < y.first; });
+  std::string out;
+  for (auto& p : parts) out += p.second;
+  return out;
+}
+
+// --- 14) 複数生産者レコードシンク ---
+// 複数スレッドが共有ステージングバッファのスロットを fetch_add で予約して
+// その場でエンコードし、専用の書き出しスレッドが完成したスロットを予約順に
+// まとめて書き出す。生産者側はロックを取らない。
+// encode が例外を投げたスロットは「スキップ」として確定し、書き出さない。
+// 出力ストリームが失敗した後は書き出しをやめ、close() がエラーを返す。
+class RecordSink {
+  const BinarySchema& schema;
+  std::ostream& os;
+  const size_t capacity;  // スロット数 (2 のべき乗)
+  const size_t stride;
+  std::vector<char> staging;
+  // slotSeq[i] == seq + 1 ならシーケンス seq のスロット i は書き込み済み。
+  // kSkipped が立っていれば確定済みだが中身は捨てる。
+  std::unique_ptr<std::atomic<uint64_t>[]> slotSeq;
+  static constexpr uint64_t kSkipped = uint64_t{1} << 63;
+
+  alignas(kCacheLine) std::atomic<uint64_t> next{0};  // 次に予約する seq
+  alignas(kCacheLine) std::atomic<uint64_t> flushed{0};  // 書き出し済み seq
+  std::atomic<uint32_t> flushSignal{0};
+  alignas(kCacheLine) std::atomic<uint32_t> commitSignal{0};
+  std::atomic<bool> writerSleeping{false};
+  std::atomic<bool> closing{false};
+
+  // 書き手スレッドだけが増やし、他スレッドは動作中にも読む (統計用)
+  std::atomic<size_t> writeCalls{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<uint64_t> skipped{0};
+  std::atomic<bool> failed{false};
+  std::thread writer;
+
+  bool committed(uint64_t seq) const {
+    return (slotSeq[seq & (capacity - 1)].load(std::memory_order_acquire) &
+            ~kSkipped) == seq + 1;
+  }
+
+  void publishFlushed(uint64_t pos) {
+    flushed.store(pos, std::memory_order_release);
+    flushSignal.fetch_add(1, std::memory_order_release);
+    flushSignal.notify_all();
+  }
+
+  void commit(uint64_t seq, uint64_t mark) {
+    slotSeq[seq & (capacity - 1)].store(mark, std::memory_order_seq_cst);
+    if (writerSleeping.load(std::memory_order_seq_cst)) {
+      commitSignal.fetch_add(1, std::memory_order_release);
+      commitSignal.notify_one();
+    }
+  }
+
+  void writerLoop() {
+    traceThreadName("writer");
+    uint64_t pos = 0;
+    for (;;) {
+      // pos から連続して完成しているスロットを数える (リング末尾で打ち切る)
+      uint64_t end = pos;
+      while (end - pos < capacity &&
+             slotSeq[end & (capacity - 1)].load(std::memory_order_acquire) ==
+                 end + 1 &&
+             ((end + 1) & (capacity - 1)) != 0)
+        ++end;
+      if (end - pos < capacity &&
+          slotSeq[end & (capacity - 1)].load(std::memory_order_acquire) ==
+              end + 1)
+        ++end;  // リング末尾のスロット
+      if (end != pos) {
+        // 失敗後も位置は進め、生産者を止めない
+        if (!failed.load(std::memory_order_relaxed)) {
+          TraceScope trace("write");
+          os.write(staging.data() + (pos & (capacity - 1)) * stride,
+                   static_cast<std::streamsize>((end - pos) * stride));
+          writeCalls.store(writeCalls.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+          if (os)
+            written.store(written.load(std::memory_order_relaxed) + end - pos,
+                          std::memory_order_relaxed);
+          else
+            failed.store(true, std::memory_order_release);
+        }
+        pos = end;
+        publishFlushed(pos);
+        continue;
+      }
+      if (committed(pos)) {  // スキップ印の付いたスロット
+        skipped.store(skipped.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        publishFlushed(++pos);
+        continue;
+      }
+      if (closing.load(std::memory_order_acquire) &&
+          pos == next.load(std::memory_order_acquire))
+        break;
+      uint32_t sig = commitSignal.load(std::memory_order_acquire);
+      writerSleeping.store(true, std::memory_order_seq_cst);
+      if ((slotSeq[pos & (capacity - 1)].load(std::memory_order_seq_cst) &
+           ~kSkipped) != pos + 1 &&
+          !closing.load(std::memory_order_seq_cst))
+        commitSignal.wait(sig, std::memory_order_acquire);
+      writerSleeping.store(false, std::memory_order_relaxed);
+    }
+    if (!failed.load(std::memory_order_relaxed) && !os.flush())
+      failed.store(true, std::memory_order_release);
+  }
+
+ public:
+  RecordSink(std::ostream& out, const BinarySchema& s,
+             size_t capacityRecords = 1 << 14)
+      : schema(s),
+        os(out),
+        capacity(std::bit_ceil(std::max<size_t>(capacityRecords, 2))),
+        stride(s.totalSize),
+        staging(capacity * stride),
+        slotSeq(new std::atomic<uint64_t>[capacity]) {
+    for (size_t i = 0; i < capacity; ++i)
+      slotSeq[i].store(0, std::memory_order_relaxed);
+    writer = std::thread([this] { writerLoop(); });
+  }
+  ~RecordSink() { (void)close(); }
+  RecordSink(const RecordSink&) = delete;
+  RecordSink& operator=(const RecordSink&) = delete;
+
+  // スロットを予約し encode(MutableRecordView&) で中身を書かせてから確定する。
+  // スロットは 0 埋め済みで、チェックサムは確定時に計算される。
+  // encode が例外を投げてもスロットはスキップとして確定してから伝播するので、
+  // 書き手や他の生産者が止まることはない。
+  // latency を渡すと予約から確定までの時間 (ns) を記録する。ヒストグラムは
+  // 呼び出しスレッド専用のものを渡し、後で SharedLatencyHistogram に合算する。
+  template <typename Encode>
+  void emit(Encode&& encode, LatencyHistogram* latency = nullptr) {
+    auto t0 = latency ? std::chrono::steady_clock::now()
+                      : std::chrono::steady_clock::time_point{};
+    uint64_t seq = next.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+      uint32_t sig = flushSignal.load(std::memory_order_acquire);
+      if (seq - flushed.load(std::memory_order_acquire) < capacity) break;
+      flushSignal.wait(sig, std::memory_order_acquire);
+    }
+    {
+      // 正常終了しなかった場合もデストラクタでスキップとして確定する
+      struct CommitGuard {
+        RecordSink& sink;
+        uint64_t seq;
+        bool done = false;
+        ~CommitGuard() {
+          sink.commit(seq, done ? seq + 1 : (seq + 1) | kSkipped);
+        }
+      } guard{*this, seq};
+      TraceScope trace("encode");
+      char* p = staging.data() + (seq & (capacity - 1)) * stride;
+      std::memset(p, 0, stride);
+      MutableRecordView view(schema, p);
+      encode(view);
+      view.sealChecksums();
+      guard.done = true;
+    }
+    if (latency)
+      latency->record(static_cast<uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - t0)
+              .count()));
+  }
+
+  // 以降 emit しないこと。未書き出しのレコードをすべて書き出して戻る。
+  // 出力ストリームへの書き込みが途中で失敗していれば WRITE_FAILED を返す。
+  Status close() {
+    if (writer.joinable()) {
+      closing.store(true, std::memory_order_seq_cst);
+      commitSignal.fetch_add(1, std::memory_order_release);
+      commitSignal.notify_one();
+      writer.join();
+    }
+    return failed.load(std::memory_order_acquire) ? StatusCode::WRITE_FAILED
+                                                   : StatusCode::OK;
+  }
+
+  // 実際に出力できたレコード数 (スキップ分と失敗後の分は含まない)
+  uint64_t recordsWritten() const {
+    return written.load(std::memory_order_relaxed);
+  }
+  uint64_t recordsSkipped() const {
+    return skipped.load(std::memory_order_relaxed);
+  }
+  size_t writeCallCount() const {
+    return writeCalls.load(std::memory_order_relaxed);
+  }
+};
+
+// --- 14a) ヘッダとペイロードの writev 書き出し ---
+// (ヘッダ, ペイロード) の組を iovec に並べて writev でまとめて書く。
+// ヘッダは内部バッファの上で直接エンコードし、ペイロードはコピーしない。
+#if defined(__linux__)
+struct FrameWriterOptions {
+  // 1 回の writev に渡す iovec の上限 (IOV_MAX で頭打ち)
+  size_t maxIovecs = 1024;
+  // 溜めておけるヘッダの数。ペイロードのないフレームのヘッダは連続して
+  // 1 つの iovec にまとまるので、iovec 数とは別に上限を持つ。
+  size_t maxFrames = 1024;
+  // 溜まったバイト数がこれ以上になったら書き出す。0 なら iovec が埋まるか
+  // flush() が呼ばれるまで溜める。
+  size_t flushBytes = 256 << 10;
+  // フレームごとに書き出す (遅延を最小にしたい場合)
+  bool flushEachFrame = false;
+};
+
+class FrameWriter {
+  int fd;
+  const BinarySchema& schema;
+  FrameWriterOptions opts;
+  std::vector<char> headers;  // 未書き出しフレームのヘッダ (連続)
+  size_t headerCount = 0;
+  std::vector<iovec> iov;
+  size_t pendingBytes = 0;
+  size_t writeCalls = 0;
+  int deferredError = 0;  // 書き出し方針による自動 flush の失敗 (errno)
+  uint64_t framesWritten = 0;
+  uint64_t bytesWritten = 0;
+
+  // 溜まった iovec をすべて書く。失敗時は errno を返し、書けた分を iov から
+  // 取り除いて残りを保留したままにする (次の flush() で続きから書く)。
+  int writeAll() {
+    iovec* v = iov.data();
+    size_t left = iov.size();
+    while (left > 0) {
+      ssize_t n = ::writev(fd, v, static_cast<int>(left));
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        int err = errno;
+        iov.erase(iov.begin(), iov.begin() + (v - iov.data()));
+        return err;
+      }
+      ++writeCalls;
+      bytesWritten += static_cast<uint64_t>(n);
+      pendingBytes -= static_cast<size_t>(n);
+      // 途中までしか書けなかった場合は残りから続ける
+      auto done = static_cast<size_t>(n);
+      while (left > 0 && done >= v->iov_len) {
+        done -= v->iov_len;
+        ++v;
+        --left;
+      }
+      if (left > 0) {
+        v->iov_base = static_cast<char*>(v->iov_base) + done;
+        v->iov_len -= done;
+      }
+    }
+    framesWritten += headerCount;
+    iov.clear();
+    headerCount = 0;
+    pendingBytes = 0;
+    return 0;
+  }
+
+  void append(const void* p, size_t len) {
+    if (len == 0) return;
+    // 直前の iovec と連続していれば (ペイロードなしのヘッダが続く場合など)
+    // 1 つにまとめる
+    if (!iov.empty() &&
+        static_cast<const char*>(iov.back().iov_base) + iov.back().iov_len ==
+            p) {
+      iov.back().iov_len += len;
+    } else {
+      iov.push_back({const_cast<void*>(p), len});
+    }
+    pendingBytes += len;
+  }
+
+  // 次のフレームのヘッダ領域と iovec 2 つ分を確保する。前回の書き出しが
+  // 失敗していればここで書き直し、まだ失敗するならフレームを受け付けずに
+  // 例外を投げる。
+  char* reserveFrame() {
+    if (deferredError || headerCount == opts.maxFrames ||
+        iov.size() + 2 > opts.maxIovecs)
+      flush();
+    return headers.data() + headerCount * schema.totalSize;
+  }
+
+  // フレームは受け付け済みなので、ここでの失敗は次の add()/flush() で報告する
+  void afterFrame() {
+    if (opts.flushEachFrame || iov.size() + 2 > opts.maxIovecs ||
+        headerCount == opts.maxFrames ||
+        (opts.flushBytes && pendingBytes >= opts.flushBytes))
+      deferredError = writeAll();
+  }
+
+ public:
+  FrameWriter(int fileDescriptor, const BinarySchema& s,
+              FrameWriterOptions options = {})
+      : fd(fileDescriptor), schema(s), opts(options) {
+    opts.maxIovecs = std::clamp<size_t>(opts.maxIovecs, 2, IOV_MAX);
+    opts.maxFrames = std::max<size_t>(opts.maxFrames, 1);
+    headers.resize(opts.maxFrames * schema.totalSize);
+    iov.reserve(opts.maxIovecs);
+  }
+  // 書き出しに失敗しても例外は投げない。エラーを知りたければ先に flush()。
+  ~FrameWriter() { (void)writeAll(); }
+  FrameWriter(const FrameWriter&) = delete;
+  FrameWriter& operator=(const FrameWriter&) = delete;
+
+  // encode(MutableRecordView&) でヘッダを書かせ、payload を後ろに付ける。
+  // payload は書き出しが済むまで (flush() が成功するまで) 生きていること。
+  //
+  // writev の失敗は add()/flush() が std::system_error で報告する。書け
+  // なかった分は続きの位置から保留されたままで、ライタはそのまま使える:
+  // 次の add() または flush() が続きから書き直す (重複も欠落もしない)。
+  // add() が投げたときはそのフレームは受け付けられていない。
+  template <typename Encode>
+  void add(Encode&& encode, std::span<const std::byte> payload) {
+    char* h = reserveFrame();
+    std::memset(h, 0, schema.totalSize);
+    MutableRecordView view(schema, h);
+    encode(view);
+    view.sealChecksums();
+    ++headerCount;
+    append(h, schema.totalSize);
+    append(payload.data(), payload.size());
+    afterFrame();
+  }
+  // 組み立て済みのレコードをヘッダにする
+  void add(const DynamicRecord& rec, std::span<const std::byte> payload) {
+    char* h = reserveFrame();
+    rec.writeTo(std::span<std::byte>(reinterpret_cast<std::byte*>(h),
+                                     schema.totalSize));
+    ++headerCount;
+    append(h, schema.totalSize);
+    append(payload.data(), payload.size());
+    afterFrame();
+  }
+
+  void flush() {
+    deferredError = 0;
+    if (int err = writeAll())
+      BS_THROW(std::system_error(err, std::generic_category(), "writev"));
+  }
+
+  size_t writeCallCount() const { return writeCalls; }
+  uint64_t frameCount() const { return framesWritten; }
+  uint64_t byteCount() const { return bytesWritten; }
+};
+#endif
+
+// --- 14b) 共有メモリのレコードリング ---
+// POSIX 共有メモリ上の固定長レコードのリング。生産者 1 つ、消費者は任意の
+// 数のプロセスで、各スロットのシーケンス番号で発行を知らせる (Disruptor
+// 方式)。生産者は消費者を待たないので、遅れた消費者は追い越しを検出して
+// 最古の有効なレコードまで飛ぶ。消費者は共有領域に一切書き込まない。
+// 書き込み中のスロットを読むことがあるので、レコード本体は SeqlockCells と
+// 同じく 8 バイトの atomic 語単位で写し、通常のロード/ストアでは触れない。
+#if defined(__linux__)
+enum class ShmPoll : uint8_t {
+  OK,       // 1 レコードを処理した
+  EMPTY,    // 新しいレコードがない
+  OVERRUN   // 追い越された。読み飛ばした数は lost() に加算される
+};
+
+class ShmRecordRing {
+  static constexpr uint64_t kMagic = 0x474E495252534221ull;  // "!BSRRING"
+  static_assert(std::atomic<uint64_t>::is_always_lock_free,
+                "shared-memory ring needs lock-free 64-bit atomics");
+
+  // magic は他の項目を書き終えてから release で書く。接続側は acquire で
+  // 読み、一致すれば残りの項目も見えている。
+  struct alignas(kCacheLine) Header {
+    std::atomic<uint64_t> magic;
+    uint64_t recordSize;
+    uint64_t capacity;  // スロット数 (2 のべき乗)
+    uint64_t slotStride;
+    alignas(kCacheLine) std::atomic<uint64_t> cursor;  // 発行済みの数
+    std::atomic<uint32_t> closed;
+  };
+  // スロット: [seq (8 バイト)][レコード]。seq はシーケンス s のレコードが
+  // 揃っていれば s + 1、書き込み中は 0。
+  static constexpr size_t kSlotHeader = 8;
+
+  const BinarySchema* schema = nullptr;
+  std::string name;
+  Header* header = nullptr;
+  char* slots = nullptr;
+  size_t mappedBytes = 0;
+  uint64_t nextSeq = 0;  // 生産者側
+  std::vector<char> scratch;  // 生産者がエンコードする手元の領域
+
+  std::atomic<uint64_t>& seqAt(uint64_t i) const {
+    return *reinterpret_cast<std::atomic<uint64_t>*>(
+        slots + (i & (header->capacity - 1)) * header->slotStride);
+  }
+  char* recordAt(uint64_t i) const {
+    return slots + (i & (header->capacity - 1)) * header->slotStride +
+           kSlotHeader;
+  }
+  // スロット本体は 8 バイト境界から始まり、ストライドは語単位で余裕がある
+  void storeRecord(uint64_t i, const char* src) const {
+    auto* w = reinterpret_cast<uint64_t*>(recordAt(i));
+    const size_t bytes = header->recordSize;
+    for (size_t off = 0; off < bytes; off += 8) {
+      uint64_t v = 0;
+      std::memcpy(&v, src + off, std::min<size_t>(8, bytes - off));
+      std::atomic_ref<uint64_t>(w[off / 8]).store(v, std::memory_order_relaxed);
+    }
+  }
+  void loadRecord(uint64_t i, char* dst) const {
+    auto* w = reinterpret_cast<uint64_t*>(recordAt(i));
+    const size_t bytes = header->recordSize;
+    for (size_t off = 0; off < bytes; off += 8) {
+      uint64_t v =
+          std::atomic_ref<uint64_t>(w[off / 8]).load(std::memory_order_relaxed);
+      std::memcpy(dst + off, &v, std::min<size_t>(8, bytes - off));
+    }
+  }
+
+  void map(int fd, size_t bytes, int prot) {
+    void* p = mmap(nullptr, bytes, prot, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (p == MAP_FAILED)
+      BS_THROW(std::system_error(err, std::generic_category(), "mmap"));
+    mappedBytes = bytes;
+    header = static_cast<Header*>(p);
+    slots = static_cast<char*>(p) + sizeof(Header);
+  }
+
+ public:
+  // 生産者として name の共有メモリを作る (既存なら作り直す)
+  ShmRecordRing(const std::string& shmName, const BinarySchema& s,
+                size_t capacityRecords)
+      : schema(&s), name(shmName), scratch(s.totalSize) {
+    const uint64_t capacity = std::bit_ceil(std::max<size_t>(capacityRecords, 2));
+    const uint64_t stride =
+        (kSlotHeader + s.totalSize + kCacheLine - 1) / kCacheLine * kCacheLine;
+    const size_t bytes = sizeof(Header) + capacity * stride;
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+      BS_THROW(std::system_error(errno, std::generic_category(), "shm_open"));
+    if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+      int err = errno;
+      ::close(fd);
+      BS_THROW(std::system_error(err, std::generic_category(), "ftruncate"));
+    }
+    map(fd, bytes, PROT_READ | PROT_WRITE);
+    // ftruncate した領域は 0 埋めなので seq はすべて「未発行」
+    new (&header->magic) std::atomic<uint64_t>(0);
+    header->recordSize = s.totalSize;
+    header->capacity = capacity;
+    header->slotStride = stride;
+    new (&header->cursor) std::atomic<uint64_t>(0);
+    new (&header->closed) std::atomic<uint32_t>(0);
+    header->magic.store(kMagic, std::memory_order_release);
+  }
+  // 消費者として既存の共有メモリに読み取り専用で接続する
+  ShmRecordRing(const std::string& shmName, const BinarySchema& s)
+      : schema(&s), name(shmName) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+      BS_THROW(std::system_error(errno, std::generic_category(), "shm_open"));
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(Header)) {
+      ::close(fd);
+      BS_THROW(std::runtime_error("Shared-memory ring is not initialized: " +
+                                  name));
+    }
+    map(fd, static_cast<size_t>(st.st_size), PROT_READ);
+    // 生産者が初期化中 (magic 未公開) でも、壊れた/別形式の領域でも、
+    // スロットに触れる前にここで弾く
+    if (header->magic.load(std::memory_order_acquire) != kMagic)
+      BS_THROW(std::runtime_error("Shared-memory ring is not initialized: " +
+                                  name));
+    const uint64_t capacity = header->capacity;
+    const uint64_t stride = header->slotStride;
+    const bool layoutOk =
+        header->recordSize == s.totalSize && std::has_single_bit(capacity) &&
+        stride % kCacheLine == 0 && stride >= kSlotHeader + s.totalSize &&
+        capacity <= (mappedBytes - sizeof(Header)) / stride;
+    if (!layoutOk)
+      BS_THROW(std::runtime_error("Shared-memory ring does not match schema: " +
+                                  name));
+  }
+  ~ShmRecordRing() {
+    if (header) munmap(header, mappedBytes);
+  }
+  ShmRecordRing(ShmRecordRing&& o) noexcept
+      : schema(o.schema),
+        name(std::move(o.name)),
+        header(std::exchange(o.header, nullptr)),
+        slots(o.slots),
+        mappedBytes(o.mappedBytes),
+        nextSeq(o.nextSeq),
+        scratch(std::move(o.scratch)) {}
+  ShmRecordRing& operator=(ShmRecordRing&&) = delete;
+  ShmRecordRing(const ShmRecordRing&) = delete;
+
+  // 共有メモリの名前を消す (接続済みのマッピングは有効なまま)
+  static void unlink(const std::string& shmName) {
+    shm_unlink(shmName.c_str());
+  }
+
+  size_t capacity() const { return header->capacity; }
+  uint64_t published() const {
+    return header->cursor.load(std::memory_order_acquire);
+  }
+  bool closed() const {
+    return header->closed.load(std::memory_order_acquire) != 0;
+  }
+
+  // --- 生産者 ---
+  // encode(MutableRecordView&) で書いたレコードを次のスロットに発行し、
+  // そのシーケンス番号を返す。ビューは前回 publish した内容のまま渡される。
+  template <typename Encode>
+  uint64_t publish(Encode&& encode) {
+    const uint64_t seq = nextSeq++;
+    MutableRecordView view(*schema, scratch.data());
+    encode(view);
+    view.sealChecksums();
+    std::atomic<uint64_t>& slotSeq = seqAt(seq);
+    slotSeq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    storeRecord(seq, scratch.data());
+    slotSeq.store(seq + 1, std::memory_order_release);
+    header->cursor.store(seq + 1, std::memory_order_release);
+    return seq;
+  }
+  void close() { header->closed.store(1, std::memory_order_release); }
+
+  // --- 消費者 ---
+  class Reader {
+    const ShmRecordRing* ring;
+    uint64_t next;
+    std::vector<char> buf;  // 読み出したレコードの写し
+    uint64_t lostCount = 0;
+    uint64_t overruns = 0;
+
+    ShmPoll overrun() {
+      // 生産者が書いている (か書き終えた) 最新スロットの次から読み直す
+      uint64_t head = ring->published();
+      uint64_t oldest = head + 1 > ring->capacity() ? head + 1 - ring->capacity()
+                                                    : 0;
+      if (oldest > next) {
+        lostCount += oldest - next;
+        next = oldest;
+      }
+      ++overruns;
+      return ShmPoll::OVERRUN;
+    }
+
+   public:
+    Reader(const ShmRecordRing& r, uint64_t start)
+        : ring(&r), next(start), buf(r.schema->totalSize) {}
+
+    // 次のレコードを手元に写し、handler(const RecordView&, uint64_t seq)
+    // に渡す。写している間に上書きされた場合は handler を呼ばずに
+    // OVERRUN を返す。ビューは次の poll まで有効。
+    template <typename Handler>
+    ShmPoll poll(Handler&& handler) {
+      std::atomic<uint64_t>& slotSeq = ring->seqAt(next);
+      if (slotSeq.load(std::memory_order_acquire) != next + 1) {
+        if (ring->published() >= next + ring->capacity()) return overrun();
+        return ShmPoll::EMPTY;
+      }
+      ring->loadRecord(next, buf.data());
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slotSeq.load(std::memory_order_relaxed) != next + 1)
+        return overrun();
+      handler(RecordView(*ring->schema, buf.data()), next);
+      ++next;
+      return ShmPoll::OK;
+    }
+    // 生産者が close() し、発行済みをすべて読んだ
+    bool finished() const {
+      return ring->closed() && next >= ring->published();
+    }
+    uint64_t position() const { return next; }
+    uint64_t lost() const { return lostCount; }
+    uint64_t overrunCount() const { return overruns; }
+  };
+  // fromOldest なら残っている最古のレコードから、そうでなければ次に発行
+  // されるレコードから読む
+  Reader reader(bool fromOldest = true) const {
+    uint64_t head = published();
+    uint64_t start = head;
+    if (fromOldest) start = head > capacity() ? head - capacity() + 1 : 0;
+    return Reader(*this, start);
+  }
+};
+#endif
+
+// --- 14c) シーケンスロックで公開する最新レコード ---
+// 書き手が最新のレコードを上書きし続け、任意の数の読み手がロックなしで
+// その時点の値を読む。書き手はシーケンスを奇数にしてから本体を書き、
+// 偶数に戻す。読み手は前後でシーケンスを読み比べ、書き込みと重なって
+// いればやり直す。読み手は共有領域に書き込まないので、読み手が増えても
+// キャッシュラインの奪い合いは起きない。本体はデータ競合にならないよう
+// 8 バイトの atomic 語単位で読み書きする。
+
+// 固定長の値を持つセルの配列。セルは [seq][本体] でキャッシュライン単位。
+// 同じセルへの書き込みは 1 スレッドから (または外部で直列化して) 行うこと。
+class SeqlockCells {
+  size_t bytes;
+  size_t words;   // 本体の語数
+  size_t stride;  // セル間隔 (語)
+  size_t count;
+  std::vector<std::atomic<uint64_t>> storage;
+  std::atomic<uint64_t>* base;
+
+  std::atomic<uint64_t>* cell(size_t i) const { return base + i * stride; }
+
+ public:
+  SeqlockCells(size_t valueBytes, size_t cells)
+      : bytes(valueBytes),
+        words((valueBytes + 7) / 8),
+        stride((1 + words + kCacheLine / 8 - 1) / (kCacheLine / 8) *
+               (kCacheLine / 8)),
+        count(cells),
+        storage(cells * stride + kCacheLine / 8) {
+    // vector の領域はキャッシュライン境界とは限らないので先頭をずらす
+    auto addr = reinterpret_cast<uintptr_t>(storage.data());
+    base = storage.data() + (kCacheLine - addr % kCacheLine) % kCacheLine / 8;
+  }
+  SeqlockCells(const SeqlockCells&) = delete;
+  SeqlockCells& operator=(const SeqlockCells&) = delete;
+
+  size_t size() const { return count; }
+  size_t valueSize() const { return bytes; }
+
+  void store(size_t i, const char* src) {
+    std::atomic<uint64_t>* c = cell(i);
+    const uint64_t s = c[0].load(std::memory_order_relaxed);
+    c[0].store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t w = 0; w < words; ++w) {
+      uint64_t v = 0;
+      std::memcpy(&v, src + w * 8, std::min<size_t>(8, bytes - w * 8));
+      c[1 + w].store(v, std::memory_order_relaxed);
+    }
+    c[0].store(s + 2, std::memory_order_release);
+  }
+  // 一貫した内容を dst に写し、そのときの公開回数を返す (0 なら未公開で
+  // dst は 0 埋め)
+  uint64_t load(size_t i, char* dst) const {
+    const std::atomic<uint64_t>* c = cell(i);
+    for (unsigned spins = 0;; ++spins) {
+      // 書き手が途中で止まっていれば回り続けても無駄なので譲る
+      if (spins >= 64) std::this_thread::yield();
+      const uint64_t s = c[0].load(std::memory_order_acquire);
+      if (s & 1) continue;  // 書き込み中
+      for (size_t w = 0; w < words; ++w) {
+        uint64_t v = c[1 + w].load(std::memory_order_relaxed);
+        std::memcpy(dst + w * 8, &v, std::min<size_t>(8, bytes - w * 8));
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (c[0].load(std::memory_order_relaxed) == s) return s / 2;
+    }
+  }
+  // seen より新しい値が公開されていれば dst に写して seen を進める
+  bool loadIfNewer(size_t i, char* dst, uint64_t& seen) const {
+    const uint64_t s = cell(i)[0].load(std::memory_order_acquire);
+    if ((s + 1) / 2 <= seen) return false;
+    seen = load(i, dst);
+    return true;
+  }
+  uint64_t version(size_t i) const {
+    return cell(i)[0].load(std::memory_order_acquire) / 2;
+  }
+};
+
+// 1 つのレコードの最新値
+class LatestRecord {
+  const BinarySchema* schema;
+  SeqlockCells cells;
+
+ public:
+  explicit LatestRecord(const BinarySchema& s)
+      : schema(&s), cells(s.totalSize, 1) {}
+
+  const BinarySchema& recordSchema() const { return *schema; }
+  void publish(const char* record) { cells.store(0, record); }
+  void publish(const RecordView& v) { cells.store(0, v.bytes()); }
+  // out (totalSize バイト) に最新値を写し、公開回数を返す
+  uint64_t read(char* out) const { return cells.load(0, out); }
+  bool readIfNewer(char* out, uint64_t& seen) const {
+    return cells.loadIfNewer(0, out, seen);
+  }
+  uint64_t version() const { return cells.version(0); }
+};
+
+// キーフィールドの値で引く最新レコードの固定長の表 (チャネルごとの最新
+// ヘッダなど)。キーが [0, size()) に収まらないレコードは受け付けない。
+class LatestRecordTable {
+  const BinarySchema* schema;
+  FieldHandle key;
+  SeqlockCells cells;
+
+ public:
+  LatestRecordTable(const BinarySchema& s, const std::string& keyField,
+                    size_t slots)
+      : schema(&s),
+        key(FieldHandle::of(s, keyField)),
+        cells(s.totalSize, slots) {}
+
+  const BinarySchema& recordSchema() const { return *schema; }
+  size_t size() const { return cells.size(); }
+  uint64_t keyOf(const char* record) const {
+    return loadBits(record, key.bitOffset, key.bitLength);
+  }
+  // レコードのキーのセルを更新する。キーが範囲外なら false。
+  bool publish(const char* record) {
+    uint64_t k = keyOf(record);
+    if (k >= cells.size()) return false;
+    cells.store(k, record);
+    return true;
+  }
+  bool publish(const RecordView& v) { return publish(v.bytes()); }
+  uint64_t read(size_t k, char* out) const { return cells.load(k, out); }
+  bool readIfNewer(size_t k, char* out, uint64_t& seen) const {
+    return cells.loadIfNewer(k, out, seen);
+  }
+  uint64_t version(size_t k) const { return cells.version(k); }
+};
+
+// --- 15) コルーチンによる非同期レコードストリーム ---
+// epoll バックエンドのイベントループ上で、ブロックせずにレコードを読み書き
+// する。少数のスレッドで多数のストリームを重ねて処理するためのもの。
+#if defined(__linux__)
+template <typename T>
+class Task;
+
+namespace async_detail {
+struct PromiseBase {
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<P> h) noexcept {
+      return h.promise().continuation;
+    }
+    void await_resume() noexcept {}
+  };
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  std::optional<T> value;
+  Task<T> get_return_object();
+  void return_value(T v) { value.emplace(std::move(v)); }
+  T result() {
+    if (error) std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+template <>
+struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() {}
+  void result() {
+    if (error) std::rethrow_exception(error);
+  }
+};
+}  // namespace async_detail
+
+// 遅延開始のコルーチン。co_await すると開始し、完了時に待ち手へ戻る。
+template <typename T = void>
+class Task {
+ public:
+  using promise_type = async_detail::Promise<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> h) : handle(h) {}
+  Task(Task&& o) noexcept : handle(std::exchange(o.handle, nullptr)) {}
+  Task& operator=(Task&& o) noexcept {
+    if (this != &o) {
+      if (handle) handle.destroy();
+      handle = std::exchange(o.handle, nullptr);
+    }
+    return *this;
+  }
+  ~Task() {
+    if (handle) handle.destroy();
+  }
+
+  bool done() const { return !handle || handle.done(); }
+  std::coroutine_handle<promise_type> release() {
+    return std::exchange(handle, nullptr);
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) {
+    handle.promise().continuation = waiter;
+    return handle;
+  }
+  T await_resume() { return handle.promise().result(); }
+
+ private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace async_detail {
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+}  // namespace async_detail
+
+// 値を 1 つずつ非同期に生成するジェネレータ。
+//   while (const T* v = co_await gen.next()) { ... }
+template <typename T>
+class AsyncGenerator {
+ public:
+  struct promise_type {
+    std::optional<T> current;
+    std::coroutine_handle<> consumer;
+    std::exception_ptr error;
+
+    AsyncGenerator get_return_object() {
+      return AsyncGenerator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    struct YieldAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> h) noexcept {
+        return h.promise().consumer;
+      }
+      void await_resume() noexcept {}
+    };
+    YieldAwaiter yield_value(T v) {
+      current.emplace(std::move(v));
+      return {};
+    }
+    YieldAwaiter final_suspend() noexcept {
+      current.reset();
+      return {};
+    }
+    void return_void() {}
+    void unhandled_exception() { error = std::current_exception(); }
+  };
+
+  explicit AsyncGenerator(std::coroutine_handle<promise_type> h) : handle(h) {}
+  AsyncGenerator(AsyncGenerator&& o) noexcept
+      : handle(std::exchange(o.handle, nullptr)) {}
+  ~AsyncGenerator() {
+    if (handle) handle.destroy();
+  }
+
+  struct NextAwaiter {
+    std::coroutine_handle<promise_type> gen;
+    bool await_ready() const noexcept { return gen.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+      gen.promise().consumer = h;
+      return gen;
+    }
+    // 終端に達したら nullptr
+    const T* await_resume() {
+      auto& p = gen.promise();
+      if (p.error) std::rethrow_exception(p.error);
+      return gen.done() ? nullptr : &*p.current;
+    }
+  };
+  NextAwaiter next() { return {handle}; }
+
+ private:
+  std::coroutine_handle<promise_type> handle;
+};
+
+// epoll によるシングルスレッドのイベントループ
+class EventLoop {
+  struct Waiters {
+    std::coroutine_handle<> reader;
+    std::coroutine_handle<> writer;
+    bool added = false;
+  };
+  int epfd;
+  std::deque<std::coroutine_handle<>> ready;
+  std::unordered_map<int, Waiters> waiters;
+  std::vector<std::coroutine_handle<async_detail::Promise<void>>> spawned;
+  size_t blocked = 0;
+
+  void arm(int fd) {
+    Waiters& w = waiters[fd];
+    epoll_event ev{};
+    ev.events = EPOLLONESHOT | (w.reader ? EPOLLIN : 0u) |
+                (w.writer ? EPOLLOUT : 0u);
+    ev.data.fd = fd;
+    int rc = epoll_ctl(epfd, w.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+    if (rc == 0) {
+      w.added = true;
+      return;
+    }
+    if (errno == EPERM) {  // 通常ファイルは常に読み書き可能
+      for (auto* h : {&w.reader, &w.writer})
+        if (*h) {
+          ready.push_back(std::exchange(*h, nullptr));
+          --blocked;
+        }
+      return;
+    }
+    BS_THROW(std::system_error(errno, std::generic_category(), "epoll_ctl"));
+  }
+
+ public:
+  EventLoop() : epfd(epoll_create1(EPOLL_CLOEXEC)) {
+    if (epfd < 0)
+      BS_THROW(
+          std::system_error(errno, std::generic_category(), "epoll_create1"));
+  }
+  ~EventLoop() {
+    for (auto h : spawned) h.destroy();
+    ::close(epfd);
+  }
+  EventLoop(const EventLoop&) = delete;
+  EventLoop& operator=(const EventLoop&) = delete;
+
+  // fd が読み書き可能になるまで待つ awaiter
+  struct IoAwaiter {
+    EventLoop& loop;
+    int fd;
+    bool write;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+      Waiters& w = loop.waiters[fd];
+      (write ? w.writer : w.reader) = h;
+      ++loop.blocked;
+      loop.arm(fd);
+    }
+    void await_resume() const noexcept {}
+  };
+  IoAwaiter readable(int fd) { return {*this, fd, false}; }
+  IoAwaiter writable(int fd) { return {*this, fd, true}; }
+
+  // fd をイベントループから外す (close 前に呼ぶ)
+  void forget(int fd) {
+    auto it = waiters.find(fd);
+    if (it == waiters.end()) return;
+    if (it->second.added) epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    waiters.erase(it);
+  }
+
+  // タスクを切り離して実行する。完了したタスクの例外は run() が投げ直す。
+  void spawn(Task<void> task) {
+    auto h = task.release();
+    spawned.push_back(h);
+    ready.push_back(h);
+  }
+
+  // 実行可能なコルーチンがなくなり、待機中のものもなくなるまで回す
+  void run() {
+    epoll_event events[64];
+    for (;;) {
+      while (!ready.empty()) {
+        auto h = ready.front();
+        ready.pop_front();
+        h.resume();
+      }
+      for (auto it = spawned.begin(); it != spawned.end();) {
+        if (!it->done()) {
+          ++it;
+          continue;
+        }
+        auto error = it->promise().error;
+        it->destroy();
+        it = spawned.erase(it);
+        if (error) std::rethrow_exception(error);
+      }
+      if (blocked == 0) break;
+      int n = epoll_wait(epfd, events, 64, -1);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        BS_THROW(
+            std::system_error(errno, std::generic_category(), "epoll_wait"));
+      }
+      for (int i = 0; i < n; ++i) {
+        Waiters& w = waiters[events[i].data.fd];
+        uint32_t e = events[i].events;
+        bool hup = e & (EPOLLHUP | EPOLLERR);
+        if (w.reader && (e & EPOLLIN || hup)) {
+          ready.push_back(std::exchange(w.reader, nullptr));
+          --blocked;
+        }
+        if (w.writer && (e & EPOLLOUT || hup)) {
+          ready.push_back(std::exchange(w.writer, nullptr));
+          --blocked;
+        }
+        if (w.reader || w.writer) arm(events[i].data.fd);
+      }
+    }
+  }
+};
+
+inline void setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    BS_THROW(std::system_error(errno, std::generic_category(), "fcntl"));
+}
+
+// 非ブロッキング fd からレコードをバッチ単位で読む非同期ソース
+class AsyncRecordSource {
+  EventLoop& loop;
+  int fd;
+  const BinarySchema& schema;
+  std::vector<char> buf;
+  size_t filled = 0;
+  size_t consumed = 0;  // 前回のバッチで渡したバイト数
+  bool eof = false;
+
+ public:
+  struct Batch {
+    const BinarySchema* schema;
+    const char* data;
+    size_t count;
+    RecordView operator[](size_t i) const {
+      return RecordView(*schema, data + i * schema->totalSize);
+    }
+  };
+
+  AsyncRecordSource(EventLoop& l, int f, const BinarySchema& s,
+                    size_t batchRecords = 256)
+      : loop(l), fd(f), schema(s), buf(batchRecords * s.totalSize) {
+    setNonBlocking(fd);
+  }
+
+  // 1 レコード以上たまるまで待ってバッチを返す。終端では count == 0。
+  // 返したバッチは次の呼び出しまで有効。
+  Task<Batch> next_batch() {
+    const size_t stride = schema.totalSize;
+    std::memmove(buf.data(), buf.data() + consumed, filled - consumed);
+    filled -= consumed;
+    consumed = 0;
+    while (!eof && filled < buf.size()) {
+      ssize_t n = ::read(fd, buf.data() + filled, buf.size() - filled);
+      if (n > 0) {
+        filled += static_cast<size_t>(n);
+      } else if (n == 0) {
+        eof = true;
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (filled >= stride) break;
+        co_await loop.readable(fd);
+      } else if (errno != EINTR) {
+        BS_THROW(std::system_error(errno, std::generic_category(), "read"));
+      }
+    }
+    size_t count = filled / stride;
+    consumed = count * stride;
+    co_return Batch{&schema, buf.data(), count};
+  }
+};
+
+// 非ブロッキング fd にレコードを書く非同期シンク
+class AsyncRecordSink {
+  EventLoop& loop;
+  int fd;
+  const BinarySchema& schema;
+
+ public:
+  AsyncRecordSink(EventLoop& l, int f, const BinarySchema& s)
+      : loop(l), fd(f), schema(s) {
+    setNonBlocking(fd);
+  }
+
+  // data に並んだ count 個のレコードをすべて書き終えるまで待つ
+  Task<void> write(const char* data, size_t count) {
+    size_t left = count * schema.totalSize;
+    while (left > 0) {
+      ssize_t n = ::write(fd, data, left);
+      if (n >= 0) {
+        data += n;
+        left -= static_cast<size_t>(n);
+      } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        co_await loop.writable(fd);
+      } else if (errno != EINTR) {
+        BS_THROW(std::system_error(errno, std::generic_category(), "write"));
+      }
+    }
+  }
+};
+
+// ソースのレコードを 1 件ずつ返す非同期ジェネレータ
+inline AsyncGenerator<RecordView> asyncRecords(AsyncRecordSource& source) {
+  for (;;) {
+    AsyncRecordSource::Batch batch = co_await source.next_batch();
+    if (batch.count == 0) co_return;
+    for (size_t i = 0; i < batch.count; ++i) co_yield batch[i];
+  }
+}
+#endif  // __linux__
+
+// --- 16) ホットリロード可能なスキーマレジストリ ---
+// 名前とバージョンで引ける不変のコンパイル済みスキーマ
+struct CompiledSchema {
+  std::string name;
+  uint32_t version = 0;
+  BinarySchema schema;
+  DecodePlan plan;
+
+  CompiledSchema(std::string n, uint32_t v, BinarySchema s)
+      : name(std::move(n)),
+        version(v),
+        schema(std::move(s)),
+        plan(DecodePlan::compile(schema)) {}
+};
+
+// カタログ全体を不変オブジェクトとして原子的に差し替え、古いカタログは
+// エポックベースで回収する。読み手はロックを取らず、書き手同士だけが
+// mutex で直列化される。
+class SchemaRegistry {
+  using Entry = std::shared_ptr<const CompiledSchema>;
+  struct Catalog {
+    // 名前ごとにバージョン昇順
+    std::unordered_map<std::string, std::vector<Entry>> byName;
+  };
+  struct Retired {
+    const Catalog* catalog;
+    uint64_t epoch;
+  };
+  struct alignas(kCacheLine) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};  // 0 なら空き
+  };
+  static constexpr size_t kReaderSlots = 128;
+
+  std::atomic<const Catalog*> current;
+  std::atomic<uint64_t> globalEpoch{1};
+  std::array<ReaderSlot, kReaderSlots> readers;
+  std::mutex writerMutex;
+  std::vector<Retired> retired;
+
+  // 空いている読み手スロットを確保する。全スロットを 1 周しても空きが
+  // なければ、最初の数周は回り直し、その後は yield しながら待つ。
+  // maxRounds 周 (0 なら無制限) で確保できなければ nullptr。
+  ReaderSlot* claimSlot(size_t maxRounds) {
+    size_t start = std::hash<std::thread::id>{}(std::this_thread::get_id());
+    for (size_t round = 0; maxRounds == 0 || round < maxRounds; ++round) {
+      for (size_t i = 0; i < kReaderSlots; ++i) {
+        ReaderSlot& s = readers[(start + i) % kReaderSlots];
+        if (s.epoch.load(std::memory_order_relaxed) != 0) continue;
+        uint64_t expected = 0;
+        uint64_t e = globalEpoch.load(std::memory_order_seq_cst);
+        if (s.epoch.compare_exchange_strong(expected, e,
+                                            std::memory_order_seq_cst))
+          return &s;
+      }
+      if (round >= 4) std::this_thread::yield();
+    }
+    return nullptr;
+  }
+
+  // writerMutex を保持して呼ぶ
+  void collectLocked() {
+    uint64_t oldest = ~0ull;
+    for (auto& r : readers) {
+      uint64_t e = r.epoch.load(std::memory_order_seq_cst);
+      if (e != 0) oldest = std::min(oldest, e);
+    }
+    auto keep = std::remove_if(retired.begin(), retired.end(),
+                               [&](const Retired& r) {
+                                 if (r.epoch >= oldest) return false;
+                                 delete r.catalog;
+                                 return true;
+                               });
+    retired.erase(keep, retired.end());
+  }
+
+ public:
+  SchemaRegistry() : current(new Catalog) {}
+  ~SchemaRegistry() {
+    for (auto& r : retired) delete r.catalog;
+    delete current.load();
+  }
+  SchemaRegistry(const SchemaRegistry&) = delete;
+  SchemaRegistry& operator=(const SchemaRegistry&) = delete;
+  // 同時に開ける読み取り区間の数
+  static constexpr size_t maxReaders() { return kReaderSlots; }
+
+  // 読み取り区間。生きている間は find() の結果が有効。
+  // 同時に開ける区間は kReaderSlots 個まで。
+  class ReadGuard {
+    ReaderSlot* slot = nullptr;
+    const Catalog* catalog;
+
+    friend class SchemaRegistry;
+    ReadGuard(SchemaRegistry& r, ReaderSlot* s)
+        : slot(s), catalog(r.current.load(std::memory_order_seq_cst)) {}
+
+   public:
+    // スロットが空くまで待つ
+    explicit ReadGuard(SchemaRegistry& r) : ReadGuard(r, r.claimSlot(0)) {}
+    ~ReadGuard() {
+      if (slot) slot->epoch.store(0, std::memory_order_release);
+    }
+    ReadGuard(ReadGuard&& o) noexcept
+        : slot(std::exchange(o.slot, nullptr)), catalog(o.catalog) {}
+    ReadGuard& operator=(ReadGuard&&) = delete;
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    // version == 0 なら最新版。見つからなければ nullptr。
+    // 返すポインタはこのガードが生きている間だけ有効 (その後も使うなら
+    // acquire() で所有権を取る)。
+    const CompiledSchema* find(const std::string& name,
+                               uint32_t version = 0) const {
+      auto it = catalog->byName.find(name);
+      if (it == catalog->byName.end()) return nullptr;
+      const auto& versions = it->second;
+      if (version == 0) return versions.back().get();
+      for (const auto& e : versions)
+        if (e->version == version) return e.get();
+      return nullptr;
+    }
+    // ガードを抜けた後も使う場合は所有権を取る
+    std::shared_ptr<const CompiledSchema> acquire(const std::string& name,
+                                                  uint32_t version = 0) const {
+      auto it = catalog->byName.find(name);
+      if (it == catalog->byName.end()) return nullptr;
+      const auto& versions = it->second;
+      if (version == 0) return versions.back();
+      for (const auto& e : versions)
+        if (e->version == version) return e;
+      return nullptr;
+    }
+  };
+  // 読み手スロットがすべて使用中なら空くまで待つ (yield で譲りながら)
+  ReadGuard read() { return ReadGuard(*this); }
+  // 待つのは maxRounds 周まで。それでも空かなければ BUSY を返す。
+  Result<ReadGuard> tryRead(size_t maxRounds = 64) {
+    ReaderSlot* s = claimSlot(std::max<size_t>(maxRounds, 1));
+    if (!s) return StatusCode::BUSY;
+    return ReadGuard(*this, s);
+  }
+
+  // 同じ名前・バージョンがあれば置き換える
+  std::shared_ptr<const CompiledSchema> publish(const std::string& name,
+                                                uint32_t version,
+                                                BinarySchema schema) {
+    if (version == 0)
+      BS_THROW(
+          std::invalid_argument("Schema version must be positive: " + name));
+    auto entry =
+        std::make_shared<const CompiledSchema>(name, version, std::move(schema));
+    std::lock_guard<std::mutex> lk(writerMutex);
+    const Catalog* old = current.load(std::memory_order_relaxed);
+    auto* next = new Catalog(*old);
+    auto& versions = next->byName[name];
+    auto pos = std::lower_bound(
+        versions.begin(), versions.end(), version,
+        [](const Entry& e, uint32_t v) { return e->version < v; });
+    if (pos != versions.end() && (*pos)->version == version)
+      *pos = entry;
+    else
+      versions.insert(pos, entry);
+    current.store(next, std::memory_order_seq_cst);
+    retired.push_back(
+        {old, globalEpoch.fetch_add(1, std::memory_order_seq_cst)});
+    collectLocked();
+    return entry;
+  }
+  std::shared_ptr<const CompiledSchema> publish(
+      const std::string& name, uint32_t version,
+      const nlohmann::ordered_json& schemaJson) {
+    BinarySchema schema;
+    schema.loadSchema(schemaJson);
+    return publish(name, version, std::move(schema));
+  }
+
+  // 回収待ちのカタログを可能な限り解放する
+  void collect() {
+    std::lock_guard<std::mutex> lk(writerMutex);
+    collectLocked();
+  }
+  size_t pendingReclaim() {
+    std::lock_guard<std::mutex> lk(writerMutex);
+    return retired.size();
+  }
+};
+
+// レジストリのスキーマでレコードを作る。レコードが生きている間は、
+// レジストリ側で差し替えられてもスキーマは解放されない。
+inline DynamicRecord makeRecord(std::shared_ptr<const CompiledSchema> cs) {
+  const BinarySchema* s = &cs->schema;
+  return DynamicRecord(std::shared_ptr<const BinarySchema>(std::move(cs), s));
+}
+
+// --- 17) バージョンによるデコード振り分け ---
+// バージョンの混在したストリームを、各レコード先頭 8 ビットのバージョンで
+// 256 要素の表を引いてスキーマとハンドラに振り分ける。各レコードは
+// decodeBatch と同じく定数とチェックサムを検証し、結果をハンドラに渡す。
+
+// dispatch() の結果。status が OK なら、入力の末尾 (末尾のレコードが不完全
+// ならその手前) まで進んだ。UNKNOWN_VERSION なら data + consumed にある
+// レコードのバージョンに経路がない。長さが分からないので読み飛ばせないが、
+// route() で登録してから data + consumed から再開できる。
+struct DispatchResult {
+  size_t consumed = 0;  // ハンドラに渡し終えたバイト数
+  size_t records = 0;   // ハンドラに渡したレコード数
+  size_t invalid = 0;   // うち定数かチェックサムの検証に失敗した数
+  Status status;
+};
+
+class VersionDispatcher {
+ public:
+  // status が OK 以外でもレコードは渡す (捨てるかどうかはハンドラが決める)
+  using Handler = std::function<void(const RecordView&, const uint64_t* row,
+                                     RecordStatus status)>;
+
+ private:
+  struct Route {
+    std::shared_ptr<const CompiledSchema> schema;
+    Handler handler;
+  };
+  std::array<Route, 256> table;
+  std::vector<uint64_t> row;
+
+ public:
+  // schema の先頭フィールドは 8 ビットのバージョンでなければならない。
+  // 定数が付いていれば version と一致すること。
+  void route(uint8_t version, std::shared_ptr<const CompiledSchema> schema,
+             Handler handler) {
+    const BinarySchema& s = schema->schema;
+    if (s.fields.empty() || s.fields[0].bitLength != 8)
+      BS_THROW(std::runtime_error(
+          "Schema '" + schema->name +
+          "' does not start with an 8-bit version field"));
+    if (s.fields[0].hasConst && s.fields[0].constValue != version)
+      BS_THROW(std::runtime_error(
+          "Schema '" + schema->name + "' has version " +
+          std::to_string(s.fields[0].constValue) + ", routed as " +
+          std::to_string(version)));
+    row.resize(std::max(row.size(), s.fields.size()));
+    table[version] = {std::move(schema), std::move(handler)};
+  }
+
+  // data[0, size) のレコードを順にデコードしてハンドラを呼ぶ。末尾の
+  // 不完全なレコードは消費しない。未登録のバージョンに当たったらそこで
+  // 止まる (例外は投げない)。
+  DispatchResult dispatch(const char* data, size_t size) {
+    auto p = reinterpret_cast<const uint8_t*>(data);
+    DispatchResult res;
+    while (res.consumed < size) {
+      const Route& r = table[p[res.consumed]];
+      if (!r.schema) {
+        res.status = StatusCode::UNKNOWN_VERSION;
+        break;
+      }
+      const DecodePlan& plan = r.schema->plan;
+      if (size - res.consumed < plan.stride) break;
+      RecordStatus st;
+      if (!decodeBatch(plan, data + res.consumed, 1, row.data(), &st))
+        ++res.invalid;
+      r.handler(RecordView(r.schema->schema, data + res.consumed), row.data(),
+                st);
+      res.consumed += plan.stride;
+      ++res.records;
+    }
+    return res;
+  }
+};
+
+// --- 18) ランダムスキーマ生成 ---
+// 負荷試験・性能試験用に、シードから決定的にスキーマとレコードを作る
+struct SplitMix64 {
+  uint64_t state;
+  explicit SplitMix64(uint64_t seed) : state(seed) {}
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  // [lo, hi] の一様乱数
+  uint64_t range(uint64_t lo, uint64_t hi) {
+    return lo + next() % (hi - lo + 1);
+  }
+  bool chance(double p) {
+    return static_cast<double>(next() >> 11) * 0x1.0p-53 < p;
+  }
+};
+
+enum class WidthDistribution : uint8_t {
+  UNIFORM,  // 1..64 一様
+  SMALL,    // 1..16 (フラグや小さなカウンタ)
+  BYTES,    // 8, 16, 32, 64
+  WIDE      // 33..64 (複数ワードにまたがりやすい)
+};
+
+struct RandomSchemaOptions {
+  size_t fieldCount = 16;
+  WidthDistribution widths = WidthDistribution::UNIFORM;
+  // バイト境界に揃えるフィールドの割合。揃える際はパディングを挟み、幅も
+  // 8/16/32/64 から選ぶ。
+  double alignedFraction = 0.25;
+  double constFraction = 0.0;  // "const" を付けるフィールドの割合
+  bool checksum = false;       // 末尾に全体を覆う CRC32C を付ける
+};
+
+inline nlohmann::ordered_json generateRandomSchema(
+    uint64_t seed, const RandomSchemaOptions& opts = {}) {
+  SplitMix64 rng(seed);
+  nlohmann::ordered_json fields = nlohmann::ordered_json::array();
+  size_t cursor = 0;
+  size_t pads = 0;
+  auto pad = [&](size_t bits) {
+    fields.push_back({{"name", "pad" + std::to_string(pads++)},
+                      {"bitLength", bits}});
+    cursor += bits;
+  };
+  for (size_t i = 0; i < opts.fieldCount; ++i) {
+    size_t width;
+    if (rng.chance(opts.alignedFraction)) {
+      if (cursor % 8) pad(8 - cursor % 8);
+      width = size_t{8} << rng.range(0, 3);
+    } else {
+      switch (opts.widths) {
+        case WidthDistribution::SMALL:
+          width = rng.range(1, 16);
+          break;
+        case WidthDistribution::BYTES:
+          width = size_t{8} << rng.range(0, 3);
+          break;
+        case WidthDistribution::WIDE:
+          width = rng.range(33, 64);
+          break;
+        default:
+          width = rng.range(1, 64);
+          break;
+      }
+    }
+    nlohmann::ordered_json f = {{"name", "f" + std::to_string(i)},
+                                {"bitLength", width}};
+    if (rng.chance(opts.constFraction))
+      f["const"] = width == 64 ? rng.next() : rng.next() & ((1ull << width) - 1);
+    fields.push_back(std::move(f));
+    cursor += width;
+  }
+  if (opts.checksum) {
+    if (cursor % 8) pad(8 - cursor % 8);
+    size_t end = cursor / 8;
+    if (end == 0) {
+      pad(8);
+      end = 1;
+    }
+    fields.push_back({{"name", "crc"},
+                      {"bitLength", 32},
+                      {"checksum", {{"algorithm", "crc32c"},
+                                    {"begin", 0},
+                                    {"end", end}}}});
+  }
+  return fields;
+}
+
+// count 個の乱数レコードを data に書く。const は守り、チェックサムは計算する。
+inline void fillRandomRecords(const BinarySchema& schema, uint64_t seed,
+                              char* data, size_t count) {
+  SplitMix64 rng(seed);
+  std::memset(data, 0, count * schema.totalSize);
+  for (size_t r = 0; r < count; ++r) {
+    MutableRecordView rec(schema, data + r * schema.totalSize);
+    for (size_t f = 0; f < schema.fields.size(); ++f) {
+      const FieldDesc& fd = schema.fields[f];
+      rec.setField(f, fd.hasConst ? fd.constValue : rng.next());
+    }
+    rec.sealChecksums();
+  }
+}
+
+inline RandomSchemaOptions parseRandomSchemaOptions(
+    const std::unordered_map<std::string, std::string>& named) {
+  RandomSchemaOptions o;
+  auto get = [&](const char* key) -> const std::string* {
+    auto it = named.find(key);
+    return it == named.end() ? nullptr : &it->second;
+  };
+  if (auto v = get("fields")) o.fieldCount = std::stoull(*v);
+  if (auto v = get("aligned")) o.alignedFraction = std::stod(*v);
+  if (auto v = get("consts")) o.constFraction = std::stod(*v);
+  if (auto v = get("checksum")) o.checksum = *v == "1" || *v == "true";
+  if (auto v = get("widths")) {
+    if (*v == "uniform")
+      o.widths = WidthDistribution::UNIFORM;
+    else if (*v == "small")
+      o.widths = WidthDistribution::SMALL;
+    else if (*v == "bytes")
+      o.widths = WidthDistribution::BYTES;
+    else if (*v == "wide")
+      o.widths = WidthDistribution::WIDE;
+    else
+      BS_THROW(std::invalid_argument("Unknown width distribution: " + *v));
+  }
+  return o;
+}
+
+// --- 19) 差分ファジング ---
+// 乱数スキーマ・バッファ・値を作り、すべてのデコード/エンコード経路を
+// 1 ビットずつ処理する参照実装と突き合わせる。書き込みでは対象外のビット
+// (前後のフィールドとレコード後ろのガード領域) が変わらないことも確かめる。
+// 不一致は FuzzFailure 例外で報告する。
+//   libFuzzer: clang++ -fsanitize=fuzzer -DBINARY_SCHEMA_FUZZ main.cpp
+//   単体実行:  fuzz [--iterations N] [--seed S] [--input file]
+struct FuzzFailure : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+namespace fuzz_detail {
+inline uint64_t refGet(const uint8_t* p, size_t bitOffset, unsigned width) {
+  uint64_t v = 0;
+  for (unsigned i = 0; i < width; ++i) {
+    size_t bit = bitOffset + i;
+    v |= static_cast<uint64_t>((p[bit / 8] >> (bit % 8)) & 1u) << i;
+  }
+  return v;
+}
+inline void refSet(uint8_t* p, size_t bitOffset, unsigned width,
+                   uint64_t value) {
+  for (unsigned i = 0; i < width; ++i) {
+    size_t bit = bitOffset + i;
+    auto m = static_cast<uint8_t>(1u << (bit % 8));
+    if ((value >> i) & 1)
+      p[bit / 8] |= m;
+    else
+      p[bit / 8] &= static_cast<uint8_t>(~m);
+  }
+}
+inline uint32_t refCrc32c(const uint8_t* p, size_t n) {
+  uint32_t crc = ~0u;
+  for (size_t i = 0; i < n; ++i) {
+    crc ^= p[i];
+    for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+  }
+  return ~crc;
+}
+inline void refSeal(const BinarySchema& schema, uint8_t* rec) {
+  for (size_t idx : schema.checksumFields) {
+    const FieldDesc& fd = schema.fields[idx];
+    uint32_t crc =
+        refCrc32c(rec + fd.checksumBegin, fd.checksumEnd - fd.checksumBegin);
+    refSet(rec, fd.bitOffset, 32, crc);
+  }
+}
+
+// 入力バイト列を先頭から消費する。尽きたら消費済みの内容から種を作った
+// 乱数で補うので、短い入力でも毎回同じ検査が決まる。
+class FuzzInput {
+  const uint8_t* p;
+  size_t n;
+  SplitMix64 rng{0x5EED};
+
+ public:
+  FuzzInput(const uint8_t* data, size_t size) : p(data), n(size) {}
+  uint8_t byte() {
+    if (n == 0) return static_cast<uint8_t>(rng.next());
+    rng.state = rng.state * 31 + *p;
+    --n;
+    return *p++;
+  }
+  uint64_t u64() {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(byte()) << (8 * i);
+    return v;
+  }
+};
+
+inline void expect(bool ok, const std::string& what) {
+  if (!ok) BS_THROW(FuzzFailure(what));
+}
+inline std::string at(const FieldDesc& fd) {
+  return " (field " + fd.name + ", bitOffset " + std::to_string(fd.bitOffset) +
+         ", bitLength " + std::to_string(fd.bitLength) + ")";
+}
+}  // namespace fuzz_detail
+
+// 1 入力分の検査。不一致があれば FuzzFailure を投げる。
+inline void fuzzOne(const uint8_t* data, size_t size) {
+  using namespace fuzz_detail;
+  FuzzInput in(data, size);
+
+  // コンパイル時に詰めたフレームと実行時エンコードの一致
+  {
+    BinarySchema hb;
+    hb.loadSchema(kTriggerTimeHeader.toJson());
+    DynamicRecord rec(hb);
+    for (const char* name : {"version", "length", "header_length", "type"})
+      rec.setValue(name, decodeStatic<kTriggerTimeHeader>(kHeartbeatFrame,
+                                                          name));
+    rec.setValue("magic", kTriggerTimeHeader.fields[1].constValue);
+    std::ostringstream os;
+    rec.write(os);
+    expect(os.str().size() == kHeartbeatFrame.size() &&
+               std::memcmp(os.str().data(), kHeartbeatFrame.data(),
+                           kHeartbeatFrame.size()) == 0,
+           "encodeStatic heartbeat frame");
+  }
+
+  RandomSchemaOptions opts;
+  opts.fieldCount = 1 + in.byte() % 48;
+  opts.widths = static_cast<WidthDistribution>(in.byte() % 4);
+  opts.alignedFraction = (in.byte() % 5) / 4.0;
+  opts.constFraction = (in.byte() % 3) / 4.0;
+  opts.checksum = in.byte() % 2;
+  BinarySchema schema;
+  schema.loadSchema(generateRandomSchema(in.u64(), opts));
+  const size_t size0 = schema.totalSize;
+  const size_t nf = schema.fields.size();
+
+  // ガード領域付きのバッファ。末尾の 16 バイトは誰も書いてはならない。
+  constexpr size_t kGuard = 16;
+  std::vector<uint8_t> buf(size0 + kGuard);
+  for (auto& b : buf) b = in.byte();
+  auto cbuf = reinterpret_cast<const char*>(buf.data());
+
+  // 参照 CRC と各 CRC 実装
+  for (size_t len : {size_t{0}, size0 / 2, size0}) {
+    uint32_t ref = refCrc32c(buf.data(), len);
+    expect(crc32c(buf.data(), len) == ref, "crc32c mismatch, length " +
+                                               std::to_string(len));
+    expect(~crc32c_detail::updateSw(~0u, buf.data(), len) == ref,
+           "crc32c slicing-by-8 mismatch, length " + std::to_string(len));
+  }
+
+  // デコード: 全経路が参照実装と一致すること
+  std::vector<uint64_t> expected(nf);
+  for (size_t f = 0; f < nf; ++f)
+    expected[f] = refGet(buf.data(), schema.fields[f].bitOffset,
+                         schema.fields[f].bitLength);
+  std::vector<char> vbuf(cbuf, cbuf + size0);
+  DecodePlan plan = DecodePlan::compile(schema);
+  RecordView view(schema, cbuf);
+  for (size_t f = 0; f < nf; ++f) {
+    const FieldDesc& fd = schema.fields[f];
+    const uint64_t e = expected[f];
+    expect(loadBits(cbuf, fd.bitOffset, fd.bitLength) == e,
+           "loadBits" + at(fd));
+    expect(readBits(vbuf, fd.bitOffset, fd.bitLength) == e,
+           "readBits" + at(fd));
+    expect(plan.extract(buf.data(), plan.steps[f]) == e,
+           "DecodePlan::extract" + at(fd));
+    expect(view.getField(f) == e, "RecordView::getField" + at(fd));
+    expect(view.getInteger(fd.name) == e, "RecordView::getInteger" + at(fd));
+    expect(view.tryGetInteger(fd.name).value_or(~e) == e,
+           "RecordView::tryGetInteger" + at(fd));
+    expect(unpackBits(reinterpret_cast<const std::byte*>(buf.data()),
+                      fd.bitOffset, fd.bitLength) == e,
+           "unpackBits" + at(fd));
+  }
+
+  // 融合デコード: 同じレコードを 5 個並べ (4 本並行 + 端数の両経路)、
+  // 一部を壊して状態コードも比べる
+  constexpr size_t kRecords = 5;
+  std::vector<char> batch(kRecords * size0);
+  std::vector<RecordStatus> refStatus(kRecords);
+  for (size_t r = 0; r < kRecords; ++r) {
+    auto rec = reinterpret_cast<uint8_t*>(batch.data() + r * size0);
+    std::memcpy(rec, buf.data(), size0);
+    if (in.byte() % 2) refSeal(schema, rec);
+    if (size0 && in.byte() % 3 == 0) rec[in.byte() % size0] ^= 1 + in.byte() % 255;
+    RecordStatus st = RecordStatus::OK;
+    for (size_t f = 0; f < nf; ++f) {
+      const FieldDesc& fd = schema.fields[f];
+      if (fd.hasConst && refGet(rec, fd.bitOffset, fd.bitLength) != fd.constValue)
+        st = RecordStatus::CONST_MISMATCH;
+    }
+    if (st == RecordStatus::OK)
+      for (size_t idx : schema.checksumFields) {
+        const FieldDesc& fd = schema.fields[idx];
+        if (refGet(rec, fd.bitOffset, 32) !=
+            refCrc32c(rec + fd.checksumBegin, fd.checksumEnd - fd.checksumBegin))
+          st = RecordStatus::CHECKSUM_MISMATCH;
+      }
+    refStatus[r] = st;
+  }
+  std::vector<uint64_t> rows(kRecords * nf);
+  std::vector<RecordStatus> status(kRecords);
+  decodeBatch(plan, batch.data(), kRecords, rows.data(), status.data());
+  std::vector<uint8_t> crcOk(kRecords);
+  verifyChecksumsBulk(schema, batch.data(), kRecords, crcOk.data());
+  for (size_t r = 0; r < kRecords; ++r) {
+    auto rec = reinterpret_cast<const uint8_t*>(batch.data() + r * size0);
+    for (size_t f = 0; f < nf; ++f) {
+      const FieldDesc& fd = schema.fields[f];
+      expect(rows[r * nf + f] == refGet(rec, fd.bitOffset, fd.bitLength),
+             "decodeBatch record " + std::to_string(r) + at(fd));
+    }
+    expect(status[r] == refStatus[r],
+           "decodeBatch status, record " + std::to_string(r));
+    bool refCrcOk = true;
+    for (size_t idx : schema.checksumFields) {
+      const FieldDesc& fd = schema.fields[idx];
+      refCrcOk &= refGet(rec, fd.bitOffset, 32) ==
+                  refCrc32c(rec + fd.checksumBegin,
+                            fd.checksumEnd - fd.checksumBegin);
+    }
+    expect((crcOk[r] != 0) == refCrcOk,
+           "verifyChecksumsBulk, record " + std::to_string(r));
+  }
+
+  // エンコード: 1 フィールドずつ書き、バッファ全体 (ガード含む) が参照
+  // 実装で書いた結果と一致すること
+  std::vector<uint64_t> values(nf);
+  for (size_t f = 0; f < nf; ++f) {
+    // 幅を超える上位ビットも渡し、マスクされることを確かめる
+    values[f] = in.u64();
+    if (in.byte() % 4 == 0) values[f] = in.byte() % 2 ? ~0ull : 0;
+  }
+  std::vector<uint8_t> want, got;
+  for (size_t f = 0; f < nf; ++f) {
+    const FieldDesc& fd = schema.fields[f];
+    want = buf;
+    refSet(want.data(), fd.bitOffset, fd.bitLength, values[f]);
+
+    got = buf;
+    storeBits(reinterpret_cast<char*>(got.data()), fd.bitOffset, fd.bitLength,
+              values[f]);
+    expect(got == want, "storeBits" + at(fd));
+
+    got = buf;
+    packBits(reinterpret_cast<std::byte*>(got.data()), fd.bitOffset,
+             fd.bitLength, values[f]);
+    expect(got == want, "packBits" + at(fd));
+
+    std::vector<char> v(buf.begin(), buf.end());
+    writeBits(v, fd.bitOffset, fd.bitLength, values[f]);
+    expect(std::memcmp(v.data(), want.data(), v.size()) == 0,
+           "writeBits" + at(fd));
+
+    got = buf;
+    MutableRecordView(schema, reinterpret_cast<char*>(got.data()))
+        .setField(f, values[f]);
+    expect(got == want, "MutableRecordView::setField" + at(fd));
+
+    got = buf;
+    MutableRecordView(schema, reinterpret_cast<char*>(got.data()))
+        .setValue(fd.name, values[f]);
+    expect(got == want, "MutableRecordView::setValue" + at(fd));
+
+    got = buf;
+    expect(MutableRecordView(schema, reinterpret_cast<char*>(got.data()))
+                   .trySetValue(fd.name, values[f])
+                   .ok() &&
+               got == want,
+           "MutableRecordView::trySetValue" + at(fd));
+  }
+
+  // 全フィールドを順に書いた後のレコード (チェックサム付き)
+  std::vector<uint8_t> full(size0);
+  for (size_t f = 0; f < nf; ++f)
+    refSet(full.data(), schema.fields[f].bitOffset, schema.fields[f].bitLength,
+           values[f]);
+  refSeal(schema, full.data());
+
+  got.assign(size0 + kGuard, 0);
+  MutableRecordView mv(schema, reinterpret_cast<char*>(got.data()));
+  for (size_t f = 0; f < nf; ++f) mv.setField(f, values[f]);
+  mv.sealChecksums();
+  expect(std::equal(full.begin(), full.end(), got.begin()) &&
+             std::all_of(got.begin() + size0, got.end(),
+                         [](uint8_t b) { return b == 0; }),
+         "MutableRecordView full record");
+
+  // 呼び出し側バッファの任意の位置へのエンコード。前後のバイトは変えない。
+  {
+    const size_t offset = in.byte() % 13;
+    std::vector<std::byte> packet(offset + size0 + kGuard, std::byte{0xa5});
+    // フィールド外のパディングビットは保持されるので、レコード部分は 0 で
+    // 始める
+    std::fill_n(packet.begin() + offset, size0, std::byte{0});
+    Result<MutableRecordView> pv = tryViewInto(schema, packet, offset);
+    expect(pv.ok(), "tryViewInto capacity");
+    MutableRecordView v = *pv;
+    for (size_t f = 0; f < nf; ++f) v.setField(f, values[f]);
+    v.sealChecksums();
+    auto isFill = [](std::byte b) { return b == std::byte{0xa5}; };
+    expect(std::memcmp(packet.data() + offset, full.data(), size0) == 0 &&
+               std::all_of(packet.begin(), packet.begin() + offset, isFill) &&
+               std::all_of(packet.begin() + offset + size0, packet.end(),
+                           isFill),
+           "tryViewInto encode");
+    expect(tryViewOf(schema, packet, offset).ok(), "tryViewOf capacity");
+    std::span<std::byte> tight(packet.data(), offset + size0);
+    expect(!tryViewInto(schema, tight.first(tight.size() - 1), offset).ok() ||
+               size0 == 0,
+           "tryViewInto must reject a short buffer");
+  }
+
+  // テンプレートから複製し、全フィールドをハンドルで書く
+  RecordTemplate tmpl(schema);
+  got.assign(size0 + kGuard, 0);
+  tmpl.stamp(reinterpret_cast<char*>(got.data()), [&](MutableRecordView& v) {
+    for (size_t f = 0; f < nf; ++f)
+      v.set(tmpl.handle(schema.fields[f].name), values[f]);
+  });
+  expect(std::equal(full.begin(), full.end(), got.begin()) &&
+             std::all_of(got.begin() + size0, got.end(),
+                         [](uint8_t b) { return b == 0; }),
+         "RecordTemplate::stamp");
+
+  DynamicRecord rec(schema);
+  for (size_t f = 0; f < nf; ++f) {
+    const FieldDesc& fd = schema.fields[f];
+    if (f % 3 == 0)
+      rec.setValue(fd.name, values[f]);
+    else if (f % 3 == 1)
+      rec[fd.name] = values[f];
+    else
+      expect(rec.trySetValue(fd.name, values[f]).ok(),
+             "DynamicRecord::trySetValue" + at(fd));
+  }
+  std::vector<std::byte> direct(size0);
+  expect(rec.tryWriteTo(direct).ok() &&
+             std::memcmp(direct.data(), full.data(), size0) == 0,
+         "DynamicRecord::tryWriteTo");
+  std::ostringstream os;
+  static_cast<const DynamicRecord&>(rec).write(os);
+  const std::string out = os.str();
+  expect(out.size() == size0 &&
+             std::memcmp(out.data(), full.data(), size0) == 0,
+         "DynamicRecord::write");
+  // write() はチェックサムを出力側だけで計算するので、ここで buf にも反映する
+  rec.sealChecksums();
+  for (size_t f = 0; f < nf; ++f) {
+    const FieldDesc& fd = schema.fields[f];
+    uint64_t e = refGet(full.data(), fd.bitOffset, fd.bitLength);
+    expect(rec.getInteger(fd.name) == e, "DynamicRecord::getInteger" + at(fd));
+    expect(static_cast<uint64_t>(rec[fd.name]) == e,
+           "DynamicRecord::operator[]" + at(fd));
+    expect(rec.tryGetInteger(fd.name).value_or(~e) == e,
+           "DynamicRecord::tryGetInteger" + at(fd));
+  }
+
+  // 書き出したレコードの読み戻し (チェックサム検証を含む)
+  std::istringstream is(out);
+  DynamicRecord back(schema);
+  back.read(is);
+  for (size_t f = 0; f < nf; ++f)
+    expect(back.getInteger(schema.fields[f].name) ==
+               refGet(full.data(), schema.fields[f].bitOffset,
+                      schema.fields[f].bitLength),
+           "DynamicRecord::read" + at(schema.fields[f]));
+
+  // 部分書き出し: 変更範囲を元のバイト列に当てると全体書き出しと一致すること
+  back.enableDirtyTracking();
+  for (size_t k = 0, edits = in.byte() % 4; k < edits; ++k) {
+    const FieldDesc& fd = schema.fields[in.byte() % nf];
+    back.setValue(fd.name, in.u64());
+  }
+  std::vector<uint8_t> patched = full;
+  back.writeDirty([&](size_t offset, const char* p, size_t len) {
+    expect(offset + len <= size0, "DynamicRecord::writeDirty range");
+    std::memcpy(patched.data() + offset, p, len);
+  });
+  std::ostringstream whole;
+  back.write(whole);
+  expect(std::memcmp(whole.str().data(), patched.data(), size0) == 0,
+         "DynamicRecord::writeDirty");
+}
+
+// 単体実行。inputPath があればそのファイルを 1 回だけ検査し (libFuzzer の
+// クラッシュ入力の再現用)、なければ乱数入力を iterations 回検査する。
+inline int runFuzz(size_t iterations, uint64_t seed,
+                   const std::string& inputPath) {
+  // 例外なしのビルドでは不一致の時点で abort する
+  auto check = [](const std::vector<uint8_t>& input, const std::string& label) {
+#if BINARY_SCHEMA_EXCEPTIONS
+    try {
+      fuzzOne(input.data(), input.size());
+      return true;
+    } catch (const FuzzFailure& e) {
+      std::cerr << "Error: " << label << ": " << e.what() << "\n";
+      return false;
+    }
+#else
+    (void)label;
+    fuzzOne(input.data(), input.size());
+    return true;
+#endif
+  };
+  if (!inputPath.empty()) {
+    std::ifstream ifs(inputPath, std::ios::binary);
+    if (!ifs) {
+      std::cerr << "Error: could not open " << inputPath << "\n";
+      return 1;
+    }
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(ifs)),
+                               std::istreambuf_iterator<char>());
+    if (!check(input, inputPath)) return 1;
+    std::cout << inputPath << ": OK\n";
+    return 0;
+  }
+  std::vector<uint8_t> input;
+  for (size_t i = 0; i < iterations; ++i) {
+    // 入力長もばらつかせ、途中で尽きて乱数で補う経路も通す
+    SplitMix64 rng(seed + i);
+    input.resize(rng.range(0, 1024));
+    for (auto& b : input) b = static_cast<uint8_t>(rng.next());
+    if (!check(input, "iteration " + std::to_string(i) + " (--seed " +
+                          std::to_string(seed + i) + " --iterations 1)"))
+      return 1;
+  }
+  std::cout << "fuzz: " << iterations << " inputs (seed " << seed
+            << "), all backends match the reference\n";
+  return 0;
+}
+
+#ifdef BINARY_SCHEMA_FUZZ
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+#if BINARY_SCHEMA_EXCEPTIONS
+  try {
+    fuzzOne(data, size);
+  } catch (const FuzzFailure& e) {
+    std::cerr << "fuzz mismatch: " << e.what() << "\n";
+    std::abort();
+  }
+#else
+  fuzzOne(data, size);
+#endif
+  return 0;
+}
+#endif
+
+// --- B0) ベンチマーク基盤 ---
+template <typename T>
+inline void doNotOptimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 1 操作あたりのハードウェアカウンタ値。取れなかったものは NaN。
+struct PerfSample {
+  double cycles = NAN;
+  double instructions = NAN;
+  double l1dMisses = NAN;
+  double llcMisses = NAN;
+  double branchMisses = NAN;
+
+  double ipc() const { return instructions / cycles; }
+};
+
+// perf_event_open によるユーザ空間のカウンタ。開けなかったもの (コンテナ内
+// や仮想化環境でよくある) は値を NaN にする。通常は 1 つのグループとして
+// 開き、全カウンタを同じ区間で数えるので、多重化されても比 (IPC など) が
+// 別々の時間窓の値の組み合わせにならない。
+// inheritThreads なら、開いた後に作られたスレッドの分も合算する
+// (ワーカースレッドで処理が進むベンチマーク用)。既存のスレッドは数えない。
+// inherit は PERF_FORMAT_GROUP と組み合わせられないので、その場合は
+// カウンタごとに個別に開いて稼働時間で補正する (比は近似になる)。
+class PerfCounters {
+  static constexpr size_t kCount = 5;
+  std::array<int, kCount> fds;
+  int leader = -1;                     // グループのリーダー (なければ -1)
+  std::array<bool, kCount> grouped{};  // リーダーを含むグループの一員か
+
+#if defined(__linux__)
+  // group なら PERF_FORMAT_GROUP で開き、groupFd のグループに加える
+  // (groupFd が -1 なら新しいグループのリーダーになる)
+  static int open(uint32_t type, uint64_t config, bool inherit, bool group,
+                  int groupFd) {
+    perf_event_attr attr{};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    // メンバーはリーダーの有効化に従う
+    attr.disabled = groupFd < 0;
+    attr.inherit = inherit;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    if (group) attr.read_format |= PERF_FORMAT_GROUP;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1,
+                                    groupFd, PERF_FLAG_FD_CLOEXEC));
+  }
+#endif
+
+ public:
+  explicit PerfCounters(bool inheritThreads = false) {
+    fds.fill(-1);
+#if defined(__linux__)
+    constexpr uint64_t l1dReadMiss =
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const std::array<std::pair<uint32_t, uint64_t>, kCount> events{{
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, l1dReadMiss},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    }};
+    for (size_t i = 0; i < kCount; ++i) {
+      auto [type, config] = events[i];
+      if (!inheritThreads) {
+        fds[i] = open(type, config, false, true, leader);
+        if (fds[i] >= 0) {
+          grouped[i] = true;
+          if (leader < 0) leader = fds[i];
+          continue;
+        }
+      }
+      // inherit 時と、グループに入れられなかったカウンタは個別に開く
+      fds[i] = open(type, config, inheritThreads, false, -1);
+    }
+#else
+    (void)inheritThreads;
+#endif
+  }
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (int fd : fds)
+      if (fd >= 0) ::close(fd);
+#endif
+  }
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  bool available() const {
+    return std::any_of(fds.begin(), fds.end(), [](int fd) { return fd >= 0; });
+  }
+
+  void start() {
+#if defined(__linux__)
+    if (leader >= 0) {
+      ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+    for (size_t i = 0; i < kCount; ++i)
+      if (fds[i] >= 0 && !grouped[i]) {
+        ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+  }
+  // 停止して ops で割った値を返す。多重化されたカウンタは稼働時間で補正する
+  // (グループは全員が同じ稼働時間を共有する)。
+  PerfSample stop(size_t ops) {
+    std::array<double, kCount> v;
+    v.fill(NAN);
+#if defined(__linux__)
+    const double div = static_cast<double>(std::max<size_t>(ops, 1));
+    auto scaled = [&](uint64_t value, uint64_t enabled, uint64_t running) {
+      return static_cast<double>(value) * static_cast<double>(enabled) /
+             static_cast<double>(running) / div;
+    };
+    if (leader >= 0) {
+      ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      // nr, time_enabled, time_running, value[nr] (グループに加えた順)
+      uint64_t data[3 + kCount];
+      const ssize_t n = ::read(leader, data, sizeof(data));
+      const size_t words = n > 0 ? static_cast<size_t>(n) / sizeof(uint64_t) : 0;
+      if (words >= 3 && data[0] <= words - 3 && data[2] != 0)
+        for (size_t i = 0, k = 0; i < kCount && k < data[0]; ++i)
+          if (grouped[i]) v[i] = scaled(data[3 + k++], data[1], data[2]);
+    }
+    for (size_t i = 0; i < kCount; ++i) {
+      if (fds[i] < 0 || grouped[i]) continue;
+      ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t data[3];  // value, time_enabled, time_running
+      if (::read(fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        continue;
+      v[i] = scaled(data[0], data[1], data[2]);
+    }
+#endif
+    return {v[0], v[1], v[2], v[3], v[4]};
+  }
+};
+
+struct BenchResult {
+  std::string name;
+  nlohmann::ordered_json params = nlohmann::ordered_json::object();
+  size_t ops = 0;
+  double seconds = 0;
+  double bytesPerOp = 0;
+  std::optional<PerfSample> counters;  // --perf 指定時のみ
+  // BINARY_SCHEMA_TRACK_ALLOC ビルド時のみ
+  std::optional<AllocCounter> allocs;  // 計測区間の合計
+  // --latency 指定時のみ。fn() 1 回の時間を opsPerCall で割った ns/op の分布
+  std::optional<LatencyHistogram> latency;
+
+  double nsPerOp() const { return ops ? seconds * 1e9 / ops : 0; }
+  double gbPerSec() const {
+    return seconds > 0 ? bytesPerOp * ops / seconds / 1e9 : 0;
+  }
+};
+
+// 各ケースを 1 回空回ししてから、minSeconds を超えるまで繰り返し測る
+class BenchHarness {
+  double minSeconds;
+  std::vector<BenchResult> results;
+  std::unique_ptr<PerfCounters> perf;
+  bool latency = false;
+
+ public:
+  explicit BenchHarness(double minSecondsPerCase = 0.01)
+      : minSeconds(minSecondsPerCase) {}
+
+  // ハードウェアカウンタを有効にする。使えなければ時間のみを報告する。
+  // inheritThreads は PerfCounters を参照。この後に作ったスレッドだけが
+  // 数えられるので、スレッドプールより先に呼ぶこと。
+  void enablePerf(bool inheritThreads = false) {
+    perf = std::make_unique<PerfCounters>(inheritThreads);
+    if (!perf->available()) {
+      std::cerr << "note: perf counters unavailable (perf_event_paranoid or "
+                   "container restrictions); reporting time only\n";
+      perf.reset();
+    }
+  }
+  // run() の各呼び出しの時間をヒストグラムに記録する
+  void enableLatency() { latency = true; }
+  // run() を使わずに測る場合の区間指定。ops は区間内の総操作数。
+  void counterStart() {
+    if (perf) perf->start();
+  }
+  void counterStop(BenchResult& r, size_t ops) {
+    if (perf) r.counters = perf->stop(ops);
+  }
+
+  // fn() の 1 回の呼び出しを opsPerCall 回の操作として数える
+  template <typename Fn>
+  BenchResult& run(std::string name, nlohmann::ordered_json params,
+                   double bytesPerOp, size_t opsPerCall, Fn&& fn) {
+    fn();
+    BenchResult r;
+    r.name = std::move(name);
+    r.params = std::move(params);
+    r.bytesPerOp = bytesPerOp;
+    if (latency) r.latency.emplace();
+    counterStart();
+    AllocCounter allocBefore = allocTotal();
+    auto start = std::chrono::steady_clock::now();
+    auto prev = start;
+    do {
+      fn();
+      r.ops += opsPerCall;
+      auto now = std::chrono::steady_clock::now();
+      if (r.latency)
+        r.latency->record(
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(now - prev)
+                    .count()) /
+            std::max<size_t>(opsPerCall, 1));
+      prev = now;
+      r.seconds = std::chrono::duration<double>(now - start).count();
+    } while (r.seconds < minSeconds);
+    counterStop(r, r.ops);
+    if (kAllocTracking) {
+      AllocCounter after = allocTotal();
+      r.allocs = AllocCounter{after.count - allocBefore.count,
+                              after.bytes - allocBefore.bytes};
+    }
+    results.push_back(std::move(r));
+    return results.back();
+  }
+
+  // 回数固定で測った結果を追加する
+  void add(BenchResult r) { results.push_back(std::move(r)); }
+  const std::vector<BenchResult>& getResults() const { return results; }
+
+  void printTable(std::ostream& os) const {
+    const bool withCounters =
+        std::any_of(results.begin(), results.end(),
+                    [](const BenchResult& r) { return r.counters.has_value(); });
+    os << std::left << std::setw(40) << "benchmark" << std::right
+       << std::setw(12) << "ns/op" << std::setw(12) << "GB/s";
+    if (withCounters)
+      os << std::setw(10) << "cyc/op" << std::setw(10) << "ins/op"
+         << std::setw(7) << "IPC" << std::setw(10) << "L1Dm/op"
+         << std::setw(10) << "LLCm/op" << std::setw(10) << "brm/op";
+    if (kAllocTracking) os << std::setw(12) << "allocs/op";
+    if (latency)
+      os << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10)
+         << "p99.9";
+    os << "\n";
+    for (const auto& r : results) {
+      std::string label = r.name;
+      for (const auto& [k, v] : r.params.items())
+        label += " " + k + "=" + v.dump();
+      os << std::left << std::setw(40) << label << std::right << std::fixed
+         << std::setprecision(3) << std::setw(12) << r.nsPerOp()
+         << std::setw(12) << r.gbPerSec();
+      if (r.counters) {
+        const PerfSample& c = *r.counters;
+        os << std::setprecision(2) << std::setw(10) << c.cycles
+           << std::setw(10) << c.instructions << std::setw(7) << c.ipc()
+           << std::setw(10) << c.l1dMisses << std::setw(10) << c.llcMisses
+           << std::setw(10) << c.branchMisses;
+      }
+      if (r.allocs)
+        os << std::setprecision(3) << std::setw(12)
+           << static_cast<double>(r.allocs->count) /
+                  static_cast<double>(std::max<size_t>(r.ops, 1));
+      if (r.latency)
+        os << std::setw(10) << r.latency->percentile(0.5) << std::setw(10)
+           << r.latency->percentile(0.99) << std::setw(10)
+           << r.latency->percentile(0.999);
+      os << "\n";
+    }
+    os.unsetf(std::ios::floatfield);
+    os << std::setprecision(6);
+  }
+
+  nlohmann::ordered_json toJson() const {
+    nlohmann::ordered_json out = nlohmann::ordered_json::array();
+    for (const auto& r : results) {
+      nlohmann::ordered_json j;
+      j["name"] = r.name;
+      j["params"] = r.params;
+      j["ops"] = r.ops;
+      j["seconds"] = r.seconds;
+      j["ns_per_op"] = r.nsPerOp();
+      j["gb_per_s"] = r.gbPerSec();
+      if (r.counters) {
+        // NaN (取得できなかったカウンタ) は null として出力される
+        const PerfSample& c = *r.counters;
+        j["counters"] = {{"cycles", c.cycles},
+                         {"instructions", c.instructions},
+                         {"ipc", c.ipc()},
+                         {"l1d_misses", c.l1dMisses},
+                         {"llc_misses", c.llcMisses},
+                         {"branch_misses", c.branchMisses}};
+      }
+      if (r.allocs) {
+        double ops = static_cast<double>(std::max<size_t>(r.ops, 1));
+        j["allocs_per_op"] = static_cast<double>(r.allocs->count) / ops;
+        j["alloc_bytes_per_op"] = static_cast<double>(r.allocs->bytes) / ops;
+      }
+      if (r.latency) j["latency_ns"] = r.latency->toJson();
+      out.push_back(std::move(j));
+    }
+    return out;
+  }
+};
+
+// ベンチマークコマンド共通のオプション: --json <path> --min-time <sec> --perf
+// --latency
+// その他の --name value は named に入る
+struct BenchOptions {
+  std::string jsonPath;
+  double minSeconds = 0.01;
+  bool perf = false;  // --perf: ハードウェアカウンタも測る
+  bool latency = false;  // --latency: 呼び出しごとの時間分布も取る
+  std::vector<std::string> positional;
+  std::unordered_map<std::string, std::string> named;
+
+  BenchHarness makeHarness(bool perfThreads = false) const {
+    BenchHarness h(minSeconds);
+    if (perf) h.enablePerf(perfThreads);
+    if (latency) h.enableLatency();
+    return h;
+  }
+
+  static BenchOptions parse(int argc, char* argv[], int first) {
+    BenchOptions o;
+    for (int i = first; i < argc; ++i) {
+      std::string a = argv[i];
+      if (a == "--json" && i + 1 < argc)
+        o.jsonPath = argv[++i];
+      else if (a == "--min-time" && i + 1 < argc)
+        o.minSeconds = std::stod(argv[++i]);
+      else if (a == "--perf")
+        o.perf = true;
+      else if (a == "--latency")
+        o.latency = true;
+      else if (a.rfind("--", 0) == 0 && i + 1 < argc)
+        o.named[a.substr(2)] = argv[++i];
+      else
+        o.positional.push_back(a);
+    }
+    return o;
+  }
+  size_t getSize(const std::string& key, size_t def) const {
+    auto it = named.find(key);
+    return it == named.end() ? def : std::stoull(it->second);
+  }
+  std::string getString(const std::string& key, const std::string& def) const {
+    auto it = named.find(key);
+    return it == named.end() ? def : it->second;
+  }
+};
+
+// ベンチマークと自己検査のコマンドは main からしか呼ばないので、main を
+// 持たない libFuzzer ビルドでは外す
+#ifndef BINARY_SCHEMA_FUZZ
+// --random-seed が指定されていれば読み込んだスキーマの代わりに乱数スキーマ
+// を storage に作って返す
+static const BinarySchema& benchSchema(const BinarySchema& loaded,
+                                       const BenchOptions& opts,
+                                       BinarySchema& storage) {
+  auto it = opts.named.find("random-seed");
+  if (it == opts.named.end()) return loaded;
+  storage.loadSchema(generateRandomSchema(std::stoull(it->second),
+                                          parseRandomSchemaOptions(opts.named)));
+  std::cout << "random schema: seed " << it->second << ", "
+            << storage.fields.size() << " fields, " << storage.totalSize
+            << " bytes\n";
+  return storage;
+}
+
+static int writeBenchJson(const BenchOptions& opts, const std::string& suite,
+                          const BenchHarness& harness) {
+  if (opts.jsonPath.empty()) return 0;
+  std::ofstream ofs(opts.jsonPath);
+  if (!ofs) {
+    std::cerr << "Error: could not open " << opts.jsonPath
+              << " for writing\n";
+    return 1;
+  }
+  nlohmann::ordered_json j;
+  j["suite"] = suite;
+  j["results"] = harness.toJson();
+  ofs << j.dump(2) << "\n";
+  return 0;
+}
+
+// --- B1) パイプラインベンチマーク ---
+// メモリ上に合成レコード列を作り、リーダー → デコードのパイプラインを流す
+static int benchPipeline(const BinarySchema& schema, size_t records,
+                         WaitMode mode, bool perRecordTiming) {
+  std::string data(records * schema.totalSize, '\0');
+  uint64_t x = 0x9E3779B97F4A7C15ull;
+  for (auto& c : data) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    c = static_cast<char>(x);
+  }
+  std::istringstream is(data);
+  RecordStreamReader reader(is, schema);
+  uint64_t checksum = 0;
+  PipelineStats st = runPipeline(
+      reader,
+      [&](const RecordView& v) {
+        for (size_t f = 0; f < schema.fields.size(); ++f)
+          checksum += v.getField(f);
+      },
+      256, 64, mode, perRecordTiming);
+
+  double mb = static_cast<double>(st.records * schema.totalSize) / 1e6;
+  std::cout << "mode:        "
+            << (mode == WaitMode::BUSY_POLL ? "busy-poll" : "futex-wait")
+            << "\n";
+  std::cout << "records:     " << st.records << " (" << st.batches
+            << " batches)\n";
+  std::cout << "throughput:  " << st.records / st.seconds / 1e6
+            << " Mrec/s, " << mb / st.seconds << " MB/s\n";
+  std::cout << "read:        ";
+  st.readLatency.print(std::cout);
+  std::cout << "\nbatch:       ";
+  st.batchLatency.print(std::cout);
+  if (perRecordTiming) {
+    std::cout << "\ndecode:      ";
+    st.decodeLatency.print(std::cout);
+  }
+  std::cout << "\n";
+  std::cout << "checksum:    0x" << std::hex << checksum << std::dec << "\n";
+  return 0;
+}
+
+// --- B2) 非同期ストリームの多重化 ---
+// streams 本のパイプに生産者・消費者コルーチンを 1 つずつ置き、すべてを
+// 1 スレッドのイベントループで並行に回す
+#if defined(__linux__)
+static int benchAsyncPipes(const BinarySchema& schema, size_t streams,
+                           size_t records) {
+  EventLoop loop;
+  std::vector<std::array<int, 2>> pipes(streams);
+  std::vector<uint64_t> sums(streams, 0);
+  std::vector<std::unique_ptr<AsyncRecordSource>> sources;
+  std::vector<std::unique_ptr<AsyncRecordSink>> sinks;
+  std::vector<char> payload(1024 * schema.totalSize, 0);
+  for (size_t i = 0; i < payload.size() / schema.totalSize; ++i)
+    MutableRecordView(schema, payload.data() + i * schema.totalSize)
+        .setField(0, i);
+
+  for (size_t s = 0; s < streams; ++s) {
+    if (pipe(pipes[s].data()) != 0)
+      BS_THROW(std::system_error(errno, std::generic_category(), "pipe"));
+    sources.push_back(
+        std::make_unique<AsyncRecordSource>(loop, pipes[s][0], schema));
+    sinks.push_back(
+        std::make_unique<AsyncRecordSink>(loop, pipes[s][1], schema));
+  }
+  auto produce = [&](size_t s) -> Task<void> {
+    const size_t chunk = payload.size() / schema.totalSize;
+    for (size_t left = records; left > 0;) {
+      size_t n = std::min(left, chunk);
+      co_await sinks[s]->write(payload.data(), n);
+      left -= n;
+    }
+    loop.forget(pipes[s][1]);
+    ::close(pipes[s][1]);
+  };
+  auto consume = [&](size_t s) -> Task<void> {
+    auto gen = asyncRecords(*sources[s]);
+    while (const RecordView* v = co_await gen.next()) sums[s] += v->getField(0);
+    loop.forget(pipes[s][0]);
+    ::close(pipes[s][0]);
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t s = 0; s < streams; ++s) {
+    loop.spawn(consume(s));
+    loop.spawn(produce(s));
+  }
+  loop.run();
+  double sec = std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+  uint64_t total = 0;
+  for (uint64_t v : sums) total += v;
+  std::cout << "streams:     " << streams << "\n";
+  std::cout << "records:     " << streams * records << "\n";
+  std::cout << "throughput:  " << streams * records / sec / 1e6
+            << " Mrec/s\n";
+  std::cout << "checksum:    " << total << "\n";
+  return 0;
+}
+#endif
+
+// --- B3) バージョン振り分けベンチマーク ---
+// 元スキーマから version 定数とパディング長だけが異なる派生スキーマを作り、
+// 混在ストリームを表引き (定数とチェックサムの検証付き) と逐次試行の両方で
+// デコードする
+static int benchDispatch(const nlohmann::ordered_json& schemaJson,
+                         size_t versions, size_t records) {
+  std::vector<std::shared_ptr<const CompiledSchema>> schemas;
+  for (size_t v = 1; v <= versions; ++v) {
+    nlohmann::ordered_json j = schemaJson;
+    j[0]["const"] = v;
+    j.push_back({{"name", "pad"}, {"bitLength", 8 * (v % 8 + 1)}});
+    BinarySchema s;
+    s.loadSchema(j);
+    if (s.fields[0].bitLength != 8) {
+      std::cerr << "Error: first field must be an 8-bit version\n";
+      return 1;
+    }
+    schemas.push_back(std::make_shared<const CompiledSchema>(
+        "bench", static_cast<uint32_t>(v), std::move(s)));
+  }
+
+  std::vector<char> stream;
+  uint64_t x = 0x9E3779B97F4A7C15ull;
+  for (size_t i = 0; i < records; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    const auto& cs = schemas[x % versions];
+    size_t pos = stream.size();
+    stream.resize(pos + cs->schema.totalSize);
+    MutableRecordView rec(cs->schema, stream.data() + pos);
+    for (size_t f = 1; f < cs->schema.fields.size(); ++f) rec.setField(f, x);
+    rec.setField(0, cs->version);
+    rec.sealChecksums();
+  }
+
+  uint64_t sumTable = 0, sumSeq = 0;
+  VersionDispatcher dispatcher;
+  for (const auto& cs : schemas)
+    dispatcher.route(static_cast<uint8_t>(cs->version), cs,
+                     [&](const RecordView&, const uint64_t* row,
+                         RecordStatus) { sumTable += row[1]; });
+  auto t0 = std::chrono::steady_clock::now();
+  DispatchResult dispatched = dispatcher.dispatch(stream.data(), stream.size());
+  auto t1 = std::chrono::steady_clock::now();
+  if (!dispatched.status.ok() || dispatched.consumed != stream.size()) {
+    std::cerr << "Error: dispatch stopped at byte " << dispatched.consumed
+              << ": " << statusMessage(dispatched.status.error()) << "\n";
+    return 1;
+  }
+  if (dispatched.invalid) {
+    std::cerr << "Error: " << dispatched.invalid
+              << " records failed validation\n";
+    return 1;
+  }
+
+  // 逐次試行: 各スキーマの version 定数と順に比較する
+  std::vector<uint64_t> row;
+  for (size_t pos = 0; pos < stream.size();) {
+    auto p = reinterpret_cast<const uint8_t*>(stream.data() + pos);
+    for (const auto& cs : schemas) {
+      const DecodePlan& plan = cs->plan;
+      if (plan.extract(p, plan.steps[0]) != cs->schema.fields[0].constValue)
+        continue;
+      row.resize(plan.fieldCount());
+      for (size_t f = 0; f < plan.fieldCount(); ++f)
+        row[f] = plan.extract(p, plan.steps[f]);
+      sumSeq += row[1];
+      pos += plan.stride;
+      break;
+    }
+  }
+  auto t2 = std::chrono::steady_clock::now();
+
+  double tTable = std::chrono::duration<double>(t1 - t0).count();
+  double tSeq = std::chrono::duration<double>(t2 - t1).count();
+  std::cout << "versions:    " << versions << "\n";
+  std::cout << "records:     " << records << "\n";
+  std::cout << "table:       " << records / tTable / 1e6 << " Mrec/s\n";
+  std::cout << "sequential:  " << records / tSeq / 1e6 << " Mrec/s\n";
+  std::cout << "match:       " << (sumTable == sumSeq ? "yes" : "NO") << "\n";
+  return sumTable == sumSeq ? 0 : 1;
+}
+
+// --- B4) ビット演算マイクロベンチマーク ---
+static int benchMicro(const BinarySchema& schema, const BenchOptions& opts) {
+  BenchHarness harness = opts.makeHarness();
+
+  // readBits / writeBits: 128 ビット間隔の 4096 箇所を (offset, width) で走査
+  constexpr size_t kSlots = 4096;
+  std::vector<char> buf(kSlots * 16 + 16, 0x5a);
+  for (unsigned offset = 0; offset < 8; ++offset) {
+    for (unsigned width = 1; width <= 64; ++width) {
+      nlohmann::ordered_json params = {{"offset", offset}, {"width", width}};
+      const auto w = static_cast<uint8_t>(width);
+      harness.run("readBits", params, width / 8.0, kSlots, [&] {
+        uint64_t acc = 0;
+        for (size_t k = 0; k < kSlots; ++k)
+          acc ^= readBits(buf, k * 128 + offset, w);
+        doNotOptimize(acc);
+      });
+      harness.run("writeBits", params, width / 8.0, kSlots, [&] {
+        for (size_t k = 0; k < kSlots; ++k)
+          writeBits(buf, k * 128 + offset, w, k * 0x9E3779B97F4A7C15ull);
+        doNotOptimize(buf.data());
+      });
+    }
+  }
+
+  // 名前引き API と operator[] プロキシ
+  DynamicRecord rec(schema);
+  std::vector<std::string> names;
+  for (const auto& fd : schema.fields) names.push_back(fd.name);
+  const size_t n = names.size();
+  const double fieldBytes =
+      static_cast<double>(schema.totalSize) / static_cast<double>(n);
+  constexpr size_t kOps = 1024;
+  harness.run("getInteger", {}, fieldBytes, kOps, [&] {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < kOps; ++i) acc += rec.getInteger(names[i % n]);
+    doNotOptimize(acc);
+  });
+  harness.run("setValue", {}, fieldBytes, kOps, [&] {
+    for (size_t i = 0; i < kOps; ++i) rec.setValue(names[i % n], i);
+  });
+  harness.run("operator[] get", {}, fieldBytes, kOps, [&] {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < kOps; ++i) acc += rec[names[i % n]];
+    doNotOptimize(acc);
+  });
+  harness.run("operator[] set", {}, fieldBytes, kOps, [&] {
+    for (size_t i = 0; i < kOps; ++i) rec[names[i % n]] = i;
+  });
+  // レコード構築: 全フィールドを名前で書く場合と、テンプレートから複製して
+  // 末尾 2 フィールドだけをハンドルで書く場合
+  RecordTemplate tmpl(schema);
+  const FieldHandle h1 = tmpl.handle(names[n - 1]);
+  const FieldHandle h2 = tmpl.handle(names[n >= 2 ? n - 2 : 0]);
+  std::vector<char> out(kOps * schema.totalSize);
+  const double recBytes = static_cast<double>(schema.totalSize);
+  harness.run("build setValue", {}, recBytes, kOps, [&] {
+    for (size_t i = 0; i < kOps; ++i) {
+      MutableRecordView v(schema, out.data() + i * schema.totalSize);
+      for (const auto& name : names) v.setValue(name, i);
+      v.sealChecksums();
+    }
+    doNotOptimize(out.data());
+  });
+  harness.run("build template", {}, recBytes, kOps, [&] {
+    for (size_t i = 0; i < kOps; ++i)
+      tmpl.stamp(out.data() + i * schema.totalSize, [&](MutableRecordView& v) {
+        v.set(h1, i);
+        v.set(h2, i);
+      });
+    doNotOptimize(out.data());
+  });
+  harness.run("build template batch", {}, recBytes, kOps, [&] {
+    tmpl.stampBatch(out.data(), kOps, [&](MutableRecordView& v, size_t i) {
+      v.set(h1, i);
+      v.set(h2, i);
+    });
+    doNotOptimize(out.data());
+  });
+
+  std::ostringstream os;
+  harness.run("dump", {}, static_cast<double>(schema.totalSize), 1, [&] {
+    os.str("");
+    rec.dump(os);
+    doNotOptimize(os);
+  });
+
+  harness.printTable(std::cout);
+  return writeBenchJson(opts, "micro", harness);
+}
+
+// --- B5) エンドツーエンドスループットベンチマーク ---
+// スキーマから合成レコードファイルを作り、エンコード・デコード・フィルタ・
+// 集計・JSON 出力の各パイプラインをスレッド数 1..N で測る。ファイルは
+// ブロック単位で読み書きし、各ブロックの処理をプール上で並列化する。
+static int benchMacro(const BinarySchema& schema, const BenchOptions& opts) {
+  const size_t sizeMb = opts.getSize("size-mb", 256);
+  const size_t maxThreads = opts.getSize(
+      "threads", std::max(1u, std::thread::hardware_concurrency()));
+  const size_t warmup = opts.getSize("warmup", 1);
+  const size_t repeat = std::max<size_t>(1, opts.getSize("repeat", 3));
+  const std::string path = opts.getString("file", "bench_records.bin");
+  const std::string jsonOut = opts.getString("export", "/dev/null");
+
+  const size_t stride = schema.totalSize;
+  const size_t blockRecords = std::max<size_t>(1, (16u << 20) / stride);
+  const size_t records = sizeMb * (1u << 20) / stride;
+  const double totalBytes = static_cast<double>(records * stride);
+  std::vector<char> block(blockRecords * stride);
+  const DecodePlan plan = DecodePlan::compile(schema);
+
+  // ファイルをブロックごとに読み、fn(data, count) を呼ぶ
+  auto scanFile = [&](const std::function<void(const char*, size_t)>& fn) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) BS_THROW(std::runtime_error("could not open " + path));
+    RecordStreamReader reader(in, schema);
+    while (size_t n = reader.readBatch(block.data(), blockRecords))
+      fn(block.data(), n);
+  };
+
+  using Stage = std::function<void(WorkStealingPool&)>;
+  std::vector<std::pair<std::string, Stage>> stages;
+  stages.emplace_back("encode", [&](WorkStealingPool& pool) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) BS_THROW(std::runtime_error("could not open " + path));
+    for (size_t first = 0; first < records; first += blockRecords) {
+      size_t n = std::min(blockRecords, records - first);
+      pool.parallelFor(0, n, kParallelGrain, [&](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+          MutableRecordView rec(schema, block.data() + i * stride);
+          uint64_t x = (first + i + 1) * 0x9E3779B97F4A7C15ull;
+          for (size_t f = 0; f < schema.fields.size(); ++f) {
+            const FieldDesc& fd = schema.fields[f];
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            rec.setField(f, fd.hasConst ? fd.constValue : x);
+          }
+          rec.sealChecksums();
+        }
+      });
+      out.write(block.data(), static_cast<std::streamsize>(n * stride));
+    }
+  });
+  std::vector<uint64_t> rows(blockRecords * plan.fieldCount());
+  std::vector<RecordStatus> status(blockRecords);
+  stages.emplace_back("decode", [&](WorkStealingPool& pool) {
+    size_t bad = 0;
+    scanFile([&](const char* data, size_t n) {
+      bad += n - parallelDecodeBatch(plan, data, n, rows.data(),
+                                     status.data(), pool);
+    });
+    if (bad) BS_THROW(std::runtime_error("decode reported invalid records"));
+  });
+  stages.emplace_back("filter", [&](WorkStealingPool& pool) {
+    size_t hits = 0;
+    scanFile([&](const char* data, size_t n) {
+      hits += parallelFilter(
+                  schema, data, n,
+                  [](const RecordView& v) { return v.getField(0) % 4 == 0; },
+                  pool)
+                  .size();
+    });
+    doNotOptimize(hits);
+  });
+  stages.emplace_back("aggregate", [&](WorkStealingPool& pool) {
+    std::vector<FieldAggregate> aggs(schema.fields.size());
+    scanFile([&](const char* data, size_t n) {
+      for (size_t f = 0; f < aggs.size(); ++f)
+        aggs[f].merge(parallelAggregate(schema, data, n, f, pool));
+    });
+    doNotOptimize(aggs.data());
+  });
+  stages.emplace_back("export-json", [&](WorkStealingPool& pool) {
+    std::ofstream out(jsonOut);
+    scanFile([&](const char* data, size_t n) {
+      out << parallelExportJson(schema, data, n, pool);
+    });
+  });
+
+  // 処理はプールのワーカーで走るので、カウンタはワーカーの分も数える
+  // (プールはこの後に作る)
+  BenchHarness harness = opts.makeHarness(true);
+  std::vector<size_t> threadCounts;
+  for (size_t t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+  threadCounts.push_back(maxThreads);
+
+  std::cout << "records: " << records << " (" << sizeMb << " MiB, "
+            << stride << " B/record), file: " << path << "\n";
+  for (size_t threads : threadCounts) {
+    WorkStealingPool pool(threads);
+    for (auto& [name, stage] : stages) {
+      for (size_t i = 0; i < warmup; ++i) stage(pool);
+      BenchResult best;
+      harness.counterStart();
+      for (size_t i = 0; i < repeat; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        stage(pool);
+        double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+        if (i == 0 || sec < best.seconds) best.seconds = sec;
+      }
+      harness.counterStop(best, records * repeat);
+      best.name = name;
+      best.params = {{"threads", threads}};
+      best.ops = records;
+      best.bytesPerOp = static_cast<double>(stride);
+      harness.add(best);
+    }
+  }
+  std::remove(path.c_str());
+
+  // スケーリング表: 行がステージ、列がスレッド数 (Mrec/s と GB/s)
+  std::cout << std::left << std::setw(14) << "stage" << std::right;
+  for (size_t t : threadCounts)
+    std::cout << std::setw(20) << (std::to_string(t) + " thr Mrec/s|GB/s");
+  std::cout << "\n" << std::fixed << std::setprecision(2);
+  for (size_t s = 0; s < stages.size(); ++s) {
+    std::cout << std::left << std::setw(14) << stages[s].first << std::right;
+    for (size_t t = 0; t < threadCounts.size(); ++t) {
+      const BenchResult& r = harness.getResults()[t * stages.size() + s];
+      std::ostringstream cell;
+      cell << std::fixed << std::setprecision(2) << records / r.seconds / 1e6
+           << "|" << totalBytes / r.seconds / 1e9;
+      std::cout << std::setw(20) << cell.str();
+    }
+    std::cout << "\n";
+  }
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6);
+  return writeBenchJson(opts, "macro", harness);
+}
+
+// --- B6) 乱数レイアウトの一括検証とベンチマーク ---
+// 多数の乱数スキーマについて、読み込み時間・名前引き・融合デコードを測り、
+// 融合デコードの結果を loadBits と突き合わせる
+static int benchLayouts(const BenchOptions& opts) {
+  const size_t layouts = opts.getSize("layouts", 1000);
+  const uint64_t seed = opts.getSize("seed", 1);
+  const size_t recordsPerLayout = opts.getSize("records", 256);
+  RandomSchemaOptions ropts = parseRandomSchemaOptions(opts.named);
+
+  BenchResult load, lookup, decode;
+  load.name = "loadSchema";
+  lookup.name = "getInteger";
+  decode.name = "decodeBatch";
+  size_t totalFields = 0;
+  std::vector<char> data;
+  std::vector<uint64_t> rows;
+  std::vector<RecordStatus> status;
+  for (size_t l = 0; l < layouts; ++l) {
+    auto json = generateRandomSchema(seed + l, ropts);
+    BinarySchema schema;
+    auto t0 = std::chrono::steady_clock::now();
+    schema.loadSchema(json);
+    auto t1 = std::chrono::steady_clock::now();
+    load.seconds += std::chrono::duration<double>(t1 - t0).count();
+    ++load.ops;
+    load.bytesPerOp += static_cast<double>(json.dump().size());
+    totalFields += schema.fields.size();
+
+    const size_t n = recordsPerLayout;
+    data.resize(n * schema.totalSize);
+    fillRandomRecords(schema, seed ^ (l * 0x9E3779B97F4A7C15ull), data.data(),
+                      n);
+    DecodePlan plan = DecodePlan::compile(schema);
+    rows.resize(n * plan.fieldCount());
+    status.resize(n);
+    t0 = std::chrono::steady_clock::now();
+    size_t ok = decodeBatch(plan, data.data(), n, rows.data(), status.data());
+    t1 = std::chrono::steady_clock::now();
+    decode.seconds += std::chrono::duration<double>(t1 - t0).count();
+    decode.ops += n;
+    decode.bytesPerOp += static_cast<double>(n * schema.totalSize);
+    if (ok != n) {
+      std::cerr << "Error: layout " << seed + l << " rejected " << n - ok
+                << " valid records\n";
+      return 1;
+    }
+    for (size_t r = 0; r < n; ++r)
+      for (size_t f = 0; f < plan.fieldCount(); ++f) {
+        const FieldDesc& fd = schema.fields[f];
+        if (rows[r * plan.fieldCount() + f] !=
+            loadBits(data.data() + r * schema.totalSize, fd.bitOffset,
+                     fd.bitLength)) {
+          std::cerr << "Error: layout " << seed + l << " field " << fd.name
+                    << " decoded incorrectly\n";
+          return 1;
+        }
+      }
+
+    DynamicRecord rec(schema);
+    uint64_t acc = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (const auto& fd : schema.fields) acc += rec.getInteger(fd.name);
+    t1 = std::chrono::steady_clock::now();
+    doNotOptimize(acc);
+    lookup.seconds += std::chrono::duration<double>(t1 - t0).count();
+    lookup.ops += schema.fields.size();
+  }
+  // bytesPerOp は合計バイト数を積んだので平均に直す
+  load.bytesPerOp /= static_cast<double>(load.ops);
+  decode.bytesPerOp /= static_cast<double>(decode.ops);
+  lookup.bytesPerOp = 8;
+
+  BenchHarness harness;
+  harness.add(load);
+  harness.add(lookup);
+  harness.add(decode);
+  std::cout << "layouts: " << layouts << " (seed " << seed << "), "
+            << totalFields / std::max<size_t>(layouts, 1)
+            << " fields/layout on average, all decodes verified\n";
+  harness.printTable(std::cout);
+  return writeBenchJson(opts, "layouts", harness);
+}
+
+#endif  // BINARY_SCHEMA_FUZZ
+
+// --- B7) アロケーション計測の置き換え演算子と自己検査 ---
+#ifdef BINARY_SCHEMA_TRACK_ALLOC
+// malloc と free の対応を GCC が new/delete の不一致と誤検出するため抑止する
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void* operator new(std::size_t n) {
+  alloc_detail::record(n);
+  if (void* p = std::malloc(n ? n : 1)) return p;
+  BS_THROW(std::bad_alloc());
+}
+void* operator new[](std::size_t n) { return ::operator new(n); }
+void* operator new(std::size_t n, const std::nothrow_t&) noexcept {
+  alloc_detail::record(n);
+  return std::malloc(n ? n : 1);
+}
+void* operator new[](std::size_t n, const std::nothrow_t& t) noexcept {
+  return ::operator new(n, t);
+}
+void* operator new(std::size_t n, std::align_val_t al) {
+  alloc_detail::record(n);
+  const auto a = static_cast<std::size_t>(al);
+  if (void* p = std::aligned_alloc(a, (std::max<std::size_t>(n, 1) + a - 1) /
+                                          a * a))
+    return p;
+  BS_THROW(std::bad_alloc());
+}
+void* operator new[](std::size_t n, std::align_val_t al) {
+  return ::operator new(n, al);
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+#ifndef BINARY_SCHEMA_FUZZ
+// ホットパスがヒープ確保をしないことを確かめる。計測なしのビルドでは
+// 何もしない。
+static int checkAllocations(const BinarySchema& schema) {
+  if (!kAllocTracking) {
+    std::cout << "Allocation tracking is disabled; rebuild with "
+                 "-DBINARY_SCHEMA_TRACK_ALLOC\n";
+    return 0;
+  }
+  DynamicRecord rec(schema);
+  std::vector<std::string> names;
+  for (const auto& fd : schema.fields) names.push_back(fd.name);
+  std::vector<char> data(64 * schema.totalSize);
+  fillRandomRecords(schema, 1, data.data(), 64);
+  DecodePlan plan = DecodePlan::compile(schema);
+  std::vector<uint64_t> rows(64 * plan.fieldCount());
+  std::vector<RecordStatus> status(64);
+
+  int failures = 0;
+  auto expectNone = [&](const char* label, const auto& fn) {
+    AllocCounter before = allocTotal();
+    fn();
+    AllocCounter after = allocTotal();
+    uint64_t n = after.count - before.count;
+    std::cout << std::left << std::setw(28) << label << std::right
+              << std::setw(6) << n << " allocations\n";
+    if (n != 0) ++failures;
+  };
+  uint64_t acc = 0;
+  expectNone("getInteger", [&] {
+    for (const auto& n : names) acc += rec.getInteger(n);
+  });
+  expectNone("setValue", [&] {
+    for (const auto& n : names) rec.setValue(n, acc);
+  });
+  expectNone("RecordView::getField", [&] {
+    RecordView v(schema, data.data());
+    for (size_t f = 0; f < schema.fields.size(); ++f) acc += v.getField(f);
+  });
+  expectNone("MutableRecordView::setField", [&] {
+    MutableRecordView v(schema, data.data());
+    for (size_t f = 0; f < schema.fields.size(); ++f) v.setField(f, acc);
+  });
+  expectNone("decodeBatch", [&] {
+    acc += decodeBatch(plan, data.data(), 64, rows.data(), status.data());
+  });
+  RecordTemplate tmpl(schema);
+  const FieldHandle last = tmpl.handle(names.back());
+  expectNone("RecordTemplate::stampBatch", [&] {
+    tmpl.stampBatch(data.data(), 64, [&](MutableRecordView& v, size_t i) {
+      v.set(last, i);
+    });
+  });
+  LatestRecord latest(schema);
+  std::vector<char> latestOut(schema.totalSize);
+  expectNone("LatestRecord publish/read", [&] {
+    for (size_t i = 0; i < 64; ++i) {
+      latest.publish(data.data() + i * schema.totalSize);
+      acc += latest.read(latestOut.data());
+    }
+  });
+  const std::string unknown = "no-such-field-with-a-long-name";
+  expectNone("tryGetInteger (unknown)", [&] {
+    acc += rec.tryGetInteger(unknown).value_or(0);
+  });
+  expectNone("trySetValue (unknown)", [&] {
+    acc += rec.trySetValue(unknown, acc).ok();
+  });
+  doNotOptimize(acc);
+
+  // 参考値: 名前の長さによっては確保が起きうる経路
+  resetAllocStats();
+  for (const auto& n : names) acc += rec[n];
+  std::ostringstream os;
+  rec.dump(os);
+#if BINARY_SCHEMA_EXCEPTIONS
+  try {
+    rec.getInteger(unknown);
+  } catch (const std::out_of_range&) {
+  }
+#endif
+  auto stats = allocStats();
+  std::cout << "per category (operator[], dump, unknown field):\n";
+  for (size_t i = 0; i < kAllocCategories; ++i)
+    if (stats[i].count)
+      std::cout << "  " << std::left << std::setw(8)
+                << allocCategoryName(static_cast<AllocCategory>(i))
+                << std::right << std::setw(6) << stats[i].count << " allocs "
+                << std::setw(8) << stats[i].bytes << " bytes\n";
+  std::cout << (failures ? "FAILED" : "OK") << "\n";
+  return failures ? 1 : 0;
+}
+
+// --- B8) フレーム書き出しベンチマーク ---
+// ヘッダとペイロードを一時バッファに連結して write する従来の方法と、
+// FrameWriter の writev を比べる。出力はメモリ上のファイル (memfd) に書き、
+// 両者の内容が一致することも確かめる。
+#if defined(__linux__)
+static int benchFrames(const BinarySchema& schema, const BenchOptions& opts) {
+  const size_t frames = opts.getSize("frames", 200'000);
+  const size_t maxPayload = opts.getSize("payload", 1024);
+  FrameWriterOptions fopts;
+  fopts.maxIovecs = opts.getSize("iovecs", fopts.maxIovecs);
+  fopts.maxFrames = opts.getSize("max-frames", fopts.maxFrames);
+  fopts.flushBytes = opts.getSize("flush-bytes", fopts.flushBytes);
+
+  // ペイロードは 1 つの大きなバッファの切り出し (長さは 0..maxPayload)
+  SplitMix64 rng(opts.getSize("seed", 1));
+  std::vector<std::byte> pool(maxPayload * 64 + 1);
+  for (auto& b : pool) b = static_cast<std::byte>(rng.next());
+  std::vector<std::span<const std::byte>> payloads(frames);
+  for (auto& p : payloads) {
+    size_t len = rng.range(0, maxPayload);
+    p = std::span<const std::byte>(pool).subspan(
+        rng.range(0, pool.size() - len), len);
+  }
+  auto encode = [&](MutableRecordView& v, size_t i) {
+    v.setField(0, i);
+    v.setField(schema.fields.size() - 1, payloads[i].size());
+  };
+
+  int fdCopy = memfd_create("frames-copy", 0);
+  int fdIov = memfd_create("frames-writev", 0);
+  if (fdCopy < 0 || fdIov < 0)
+    BS_THROW(std::system_error(errno, std::generic_category(), "memfd_create"));
+
+  // 従来: 連結してから write
+  size_t copyCalls = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  {
+    std::vector<char> staging;
+    staging.reserve(fopts.flushBytes + schema.totalSize + maxPayload);
+    auto flush = [&] {
+      for (size_t off = 0; off < staging.size();) {
+        ssize_t n = ::write(fdCopy, staging.data() + off, staging.size() - off);
+        if (n < 0)
+          BS_THROW(std::system_error(errno, std::generic_category(), "write"));
+        off += static_cast<size_t>(n);
+        ++copyCalls;
+      }
+      staging.clear();
+    };
+    for (size_t i = 0; i < frames; ++i) {
+      size_t at = staging.size();
+      staging.resize(at + schema.totalSize);
+      std::memset(staging.data() + at, 0, schema.totalSize);
+      MutableRecordView v(schema, staging.data() + at);
+      encode(v, i);
+      v.sealChecksums();
+      auto p = reinterpret_cast<const char*>(payloads[i].data());
+      staging.insert(staging.end(), p, p + payloads[i].size());
+      if (fopts.flushBytes && staging.size() >= fopts.flushBytes) flush();
+    }
+    flush();
+  }
+  auto t1 = std::chrono::steady_clock::now();
+  FrameWriter writer(fdIov, schema, fopts);
+  for (size_t i = 0; i < frames; ++i)
+    writer.add([&](MutableRecordView& v) { encode(v, i); }, payloads[i]);
+  writer.flush();
+  auto t2 = std::chrono::steady_clock::now();
+
+  // 内容の比較
+  off_t size = lseek(fdCopy, 0, SEEK_END);
+  bool same = size == lseek(fdIov, 0, SEEK_END);
+  std::vector<char> a(1 << 16), b(1 << 16);
+  for (off_t off = 0; same && off < size;) {
+    size_t n = std::min<size_t>(a.size(), static_cast<size_t>(size - off));
+    same = pread(fdCopy, a.data(), n, off) == static_cast<ssize_t>(n) &&
+           pread(fdIov, b.data(), n, off) == static_cast<ssize_t>(n) &&
+           std::memcmp(a.data(), b.data(), n) == 0;
+    off += static_cast<off_t>(n);
+  }
+  ::close(fdCopy);
+  ::close(fdIov);
+  if (!same) {
+    std::cerr << "Error: writev output differs from the copied output\n";
+    return 1;
+  }
+
+  const double mb = static_cast<double>(size) / 1e6;
+  auto report = [&](const char* label, double sec, size_t calls) {
+    std::cout << std::left << std::setw(10) << label << std::right
+              << std::fixed << std::setprecision(1) << std::setw(10)
+              << frames / sec / 1e6 << " Mframes/s" << std::setw(10)
+              << mb / sec << " MB/s" << std::setw(10) << calls
+              << " syscalls\n";
+  };
+  std::cout << "frames: " << frames << ", payload 0.." << maxPayload
+            << " bytes, " << std::setprecision(1) << std::fixed << mb
+            << " MB, max iovecs " << fopts.maxIovecs << ", flush at "
+            << fopts.flushBytes << " bytes\n";
+  report("copy", std::chrono::duration<double>(t1 - t0).count(), copyCalls);
+  report("writev", std::chrono::duration<double>(t2 - t1).count(),
+         writer.writeCallCount());
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6) << "outputs identical\n";
+  return 0;
+}
+#endif
+
+// --- B9) 共有メモリリングのプロセス間ベンチマーク ---
+// 親プロセスが生産者、fork した子プロセスが消費者になる。各子は名前で
+// リングに読み取り専用で接続し、field 0 に入ったシーケンス番号と
+// チェックサムを確かめながら読み、結果をパイプで親に返す。
+#if defined(__linux__)
+static int benchShm(const BinarySchema& schema, const BenchOptions& opts) {
+  const size_t records = opts.getSize("records", 10'000'000);
+  const size_t consumers = std::max<size_t>(opts.getSize("consumers", 2), 1);
+  const std::string name =
+      opts.getString("name", "/bs-ring-" + std::to_string(getpid()));
+  ShmRecordRing ring(name, schema, opts.getSize("capacity", 1 << 16));
+  const FieldDesc& f0 = schema.fields[0];
+  const uint64_t mask =
+      f0.bitLength >= 64 ? ~0ull : (1ull << f0.bitLength) - 1;
+
+  struct ConsumerResult {
+    uint64_t received, lost, overruns, mismatched;
+    double seconds;
+  };
+  std::vector<pid_t> pids;
+  std::vector<int> results;
+  int ready[2];
+  if (pipe(ready) != 0)
+    BS_THROW(std::system_error(errno, std::generic_category(), "pipe"));
+  for (size_t c = 0; c < consumers; ++c) {
+    int out[2];
+    if (pipe(out) != 0)
+      BS_THROW(std::system_error(errno, std::generic_category(), "pipe"));
+    pid_t pid = fork();
+    if (pid < 0)
+      BS_THROW(std::system_error(errno, std::generic_category(), "fork"));
+    if (pid == 0) {
+      ::close(out[0]);
+      ::close(ready[0]);
+      ShmRecordRing view(name, schema);
+      auto reader = view.reader();
+      char one = 1;
+      if (::write(ready[1], &one, 1) != 1) _exit(2);
+      ConsumerResult r{};
+      uint64_t value = 0;
+      uint8_t crcOk = 1;
+      auto t0 = std::chrono::steady_clock::now();
+      for (unsigned idle = 0;;) {
+        ShmPoll st = reader.poll([&](const RecordView& v, uint64_t) {
+          value = v.getField(0);
+          verifyChecksumsBulk(schema, v.bytes(), 1, &crcOk);
+        });
+        if (st == ShmPoll::OK) {
+          ++r.received;
+          if (value != ((reader.position() - 1) & mask) || !crcOk)
+            ++r.mismatched;
+          idle = 0;
+        } else if (st == ShmPoll::EMPTY) {
+          if (reader.finished()) break;
+          if (++idle > 1024) std::this_thread::yield();
+        }
+      }
+      r.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - t0)
+                      .count();
+      r.lost = reader.lost();
+      r.overruns = reader.overrunCount();
+      bool sent = ::write(out[1], &r, sizeof r) == sizeof r;
+      _exit(sent ? 0 : 2);
+    }
+    ::close(out[1]);
+    pids.push_back(pid);
+    results.push_back(out[0]);
+  }
+  ::close(ready[1]);
+  for (size_t c = 0; c < consumers; ++c) {
+    char one;
+    if (::read(ready[0], &one, 1) != 1) {
+      std::cerr << "Error: consumer process failed to attach\n";
+      break;
+    }
+  }
+  ::close(ready[0]);
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < records; ++i)
+    ring.publish([&](MutableRecordView& v) { v.setField(0, i); });
+  ring.close();
+  const double produceSec = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - t0)
+                                .count();
+
+  int failures = 0;
+  std::cout << "records: " << records << ", consumers: " << consumers
+            << ", capacity: " << ring.capacity() << " slots\n"
+            << std::fixed << std::setprecision(1) << "producer: "
+            << records / produceSec / 1e6 << " Mrecords/s\n";
+  for (size_t c = 0; c < consumers; ++c) {
+    ConsumerResult r{};
+    bool got = ::read(results[c], &r, sizeof r) == sizeof r;
+    ::close(results[c]);
+    int status = 0;
+    waitpid(pids[c], &status, 0);
+    if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cerr << "Error: consumer " << c << " failed\n";
+      ++failures;
+      continue;
+    }
+    if (r.mismatched || r.received + r.lost != records) ++failures;
+    std::cout << "consumer " << c << ": " << r.received << " received, "
+              << r.lost << " lost in " << r.overruns << " overruns, "
+              << r.mismatched << " mismatched, "
+              << r.received / r.seconds / 1e6 << " Mrecords/s\n";
+  }
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6);
+  ShmRecordRing::unlink(name);
+  std::cout << (failures ? "FAILED" : "OK") << "\n";
+  return failures ? 1 : 0;
+}
+#endif
+
+// --- B10) 最新レコード表の読み書きベンチマーク ---
+// 1 つの書き手スレッドがキーを巡回しながら表を更新し、複数の読み手
+// スレッドが readIfNewer で読み続ける。書き手はキー以外の全フィールドに
+// 同じ通し番号 (の下位ビット) を入れるので、読み手は最も広いフィールドから
+// 番号を復元して他のフィールドとチェックサムを照合し、ちぎれた読み出しが
+// ないことを確かめる。
+static int benchLatest(const BinarySchema& schema, const BenchOptions& opts) {
+  const std::string keyName = opts.getString("key", schema.fields[0].name);
+  const FieldHandle key = FieldHandle::of(schema, keyName);
+  const size_t updates = opts.getSize("updates", 5'000'000);
+  const size_t readers = std::max<size_t>(opts.getSize("readers", 4), 1);
+  const uint64_t keySpace =
+      key.bitLength >= 20 ? 1ull << 20 : 1ull << key.bitLength;
+  const size_t channels = std::clamp<size_t>(
+      opts.getSize("channels", std::min<uint64_t>(keySpace, 256)), 1,
+      keySpace);
+  LatestRecordTable table(schema, keyName, channels);
+
+  std::vector<size_t> payload;  // キーとチェックサム以外のフィールド
+  size_t widest = SIZE_MAX;
+  for (size_t i = 0; i < schema.fields.size(); ++i) {
+    const FieldDesc& fd = schema.fields[i];
+    if (i == key.index || fd.checksumEnd != 0) continue;
+    payload.push_back(i);
+    if (widest == SIZE_MAX || fd.bitLength > schema.fields[widest].bitLength)
+      widest = i;
+  }
+  if (widest == SIZE_MAX) {
+    std::cerr << "Error: schema needs a field besides the key\n";
+    return 1;
+  }
+  auto maskOf = [&](size_t i) {
+    uint8_t len = schema.fields[i].bitLength;
+    return len >= 64 ? ~0ull : (1ull << len) - 1;
+  };
+
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> totalReads{0}, totalNew{0}, torn{0};
+  std::vector<std::thread> pool;
+  for (size_t r = 0; r < readers; ++r) {
+    pool.emplace_back([&, r] {
+      std::vector<char> buf(schema.totalSize);
+      std::vector<uint64_t> seen(channels, 0);
+      uint64_t reads = 0, fresh = 0, bad = 0;
+      uint8_t crcOk = 1;
+      for (size_t k = r % channels; !done.load(std::memory_order_relaxed);
+           k = k + 1 == channels ? 0 : k + 1) {
+        ++reads;
+        if (!table.readIfNewer(k, buf.data(), seen[k])) continue;
+        ++fresh;
+        RecordView v(schema, buf.data());
+        const uint64_t n = v.getField(widest);
+        bool ok = v.get(key) == k;
+        for (size_t i : payload) ok &= v.getField(i) == (n & maskOf(i));
+        verifyChecksumsBulk(schema, buf.data(), 1, &crcOk);
+        if (!ok || !crcOk) ++bad;
+      }
+      totalReads += reads;
+      totalNew += fresh;
+      torn += bad;
+    });
+  }
+
+  std::vector<char> rec(schema.totalSize, 0);
+  MutableRecordView w(schema, rec.data());
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t u = 0; u < updates; ++u) {
+    w.set(key, u % channels);
+    for (size_t i : payload) w.setField(i, u);
+    w.sealChecksums();
+    table.publish(rec.data());
+  }
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+  done = true;
+  for (auto& t : pool) t.join();
+
+  std::cout << "updates: " << updates << ", channels: " << channels
+            << " (key " << keyName << "), readers: " << readers << "\n"
+            << std::fixed << std::setprecision(1)
+            << "writer: " << updates / sec / 1e6 << " Mupdates/s\n"
+            << "readers: " << totalReads / sec / 1e6 << " Mreads/s, "
+            << totalNew << " new values seen\n";
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6) << "torn reads: " << torn << "\n"
+            << (torn ? "FAILED" : "OK") << "\n";
+  return torn ? 1 : 0;
+}
+
+// --- B11) 複数生産者シンクのベンチマーク ---
+// N 個の生産者スレッドが RecordSink に通し番号入りのレコードを emit し、
+// 出力をメモリ上で読み直して、全番号がちょうど 1 回ずつ揃っていること、
+// チェックサムが合うこと、書き出し呼び出しがレコード数よりずっと少ない
+// ことを確かめる。--fail-every N で N 件ごとに encode を失敗させ、
+// スキップされたスロットが書き手を止めないことも確かめる。--latency で
+// 生産者ごとに emit のレイテンシを取り、SharedLatencyHistogram に合算する。
+static int benchSink(const BinarySchema& schema, const BenchOptions& opts) {
+  const size_t producers = std::max<size_t>(opts.getSize("producers", 4), 1);
+  const size_t perProducer = opts.getSize("records", 1'000'000);
+  const size_t capacity = opts.getSize("capacity", 1 << 14);
+  const size_t failEvery = opts.getSize("fail-every", 0);
+  const uint64_t total = producers * perProducer;
+#if !BINARY_SCHEMA_EXCEPTIONS
+  if (failEvery) {
+    std::cerr << "Error: --fail-every needs a build with exceptions\n";
+    return 1;
+  }
+#endif
+
+  // 通し番号は最も広いチェックサム以外のフィールドに入れる
+  size_t idField = SIZE_MAX;
+  for (size_t i = 0; i < schema.fields.size(); ++i)
+    if (schema.fields[i].checksumEnd == 0 &&
+        (idField == SIZE_MAX ||
+         schema.fields[i].bitLength > schema.fields[idField].bitLength))
+      idField = i;
+  if (idField == SIZE_MAX || (schema.fields[idField].bitLength < 64 &&
+                              total > 1ull << schema.fields[idField].bitLength)) {
+    std::cerr << "Error: schema needs a field wide enough for " << total
+              << " record ids\n";
+    return 1;
+  }
+
+  std::ostringstream out;
+  std::atomic<uint64_t> thrown{0};
+  SharedLatencyHistogram emitLatency;
+  Status closed;
+  size_t writeCalls = 0;
+  uint64_t written = 0, skipped = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  {
+    RecordSink sink(out, schema, capacity);
+    std::vector<std::thread> pool;
+    for (size_t p = 0; p < producers; ++p) {
+      pool.emplace_back([&, p] {
+        traceThreadName("producer");
+        LatencyHistogram latency;  // このスレッド専用。最後に合算する
+        LatencyHistogram* lat = opts.latency ? &latency : nullptr;
+        for (size_t i = 0; i < perProducer; ++i) {
+          const uint64_t id = p * perProducer + i;
+          auto encode = [&](MutableRecordView& v) {
+            v.setField(idField, id);
+            if (failEvery && id % failEvery == 0)
+              BS_THROW(std::runtime_error("injected encode failure"));
+          };
+#if BINARY_SCHEMA_EXCEPTIONS
+          try {
+            sink.emit(encode, lat);
+          } catch (const std::runtime_error&) {
+            thrown.fetch_add(1, std::memory_order_relaxed);
+          }
+#else
+          sink.emit(encode, lat);
+#endif
+        }
+        emitLatency.merge(latency);
+      });
+    }
+    for (auto& t : pool) t.join();
+    closed = sink.close();
+    writeCalls = sink.writeCallCount();
+    written = sink.recordsWritten();
+    skipped = sink.recordsSkipped();
+  }
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+
+  const std::string data = out.str();
+  const size_t count = data.size() / schema.totalSize;
+  size_t failures = verifyChecksumsBulk(schema, data.data(), count);
+  std::vector<uint8_t> seen(total, 0);
+  for (size_t r = 0; r < count; ++r) {
+    uint64_t id =
+        RecordView(schema, data.data() + r * schema.totalSize).getField(idField);
+    if (id >= total || seen[id]++ || (failEvery && id % failEvery == 0))
+      ++failures;
+  }
+  const uint64_t expected = total - thrown.load();
+  if (!closed || count != expected || written != expected ||
+      skipped != thrown.load() || data.size() % schema.totalSize != 0)
+    ++failures;
+
+  // 書き込みに失敗するストリームでは close() がエラーを返すこと
+  std::ostream broken(nullptr);
+  Status brokenClosed;
+  uint64_t brokenWritten = 0;
+  {
+    RecordSink sink(broken, schema, 16);
+    for (size_t i = 0; i < 64; ++i)
+      sink.emit([&](MutableRecordView& v) { v.setField(idField, i); });
+    brokenClosed = sink.close();
+    brokenWritten = sink.recordsWritten();
+  }
+  if (brokenClosed.error() != StatusCode::WRITE_FAILED || brokenWritten != 0)
+    ++failures;
+
+  std::cout << "producers: " << producers << ", records: " << total
+            << ", capacity: " << capacity << "\n"
+            << std::fixed << std::setprecision(1)
+            << "throughput: " << total / sec / 1e6 << " Mrec/s\n";
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6) << "written: " << count
+            << ", skipped: " << skipped << " (thrown " << thrown.load()
+            << "), write calls: " << writeCalls << " ("
+            << (writeCalls ? static_cast<double>(count) / writeCalls : 0)
+            << " records/call)\n";
+  if (opts.latency) {
+    std::cout << "emit latency: ";
+    emitLatency.snapshot().print(std::cout);
+    std::cout << "\n";
+  }
+  std::cout << "broken stream: " << statusMessage(brokenClosed.error())
+            << "\n"
+            << (failures ? "FAILED" : "OK") << "\n";
+  return failures ? 1 : 0;
+}
+
+// --- B12) スキーマレジストリの自己検査 ---
+// 読み手スレッドがロックなしで引き続けている間に書き手が版を発行し続け、
+// 読み手が見る版が単調に増えること、終了後に collect() で回収待ちが
+// なくなることを確かめる。続けて読み手スロットをすべて埋め、tryRead が
+// BUSY を返すこと、その間は古いカタログが回収されないことを確かめる。
+static int checkRegistry(const BinarySchema& schema, const BenchOptions& opts) {
+  const size_t publishes = std::max<size_t>(opts.getSize("publishes", 2000), 1);
+  const size_t readerThreads =
+      std::clamp<size_t>(opts.getSize("readers", 4), 1,
+                         SchemaRegistry::maxReaders() - 1);
+  SchemaRegistry registry;
+  size_t failures = 0;
+  auto fail = [&](const char* what) {
+    std::cerr << "registry check failed: " << what << "\n";
+    ++failures;
+  };
+
+  (void)registry.publish("bench", 1, BinarySchema(schema));
+  std::atomic<bool> done{false};
+  std::atomic<uint64_t> totalReads{0}, badReads{0};
+  std::vector<std::thread> pool;
+  for (size_t r = 0; r < readerThreads; ++r) {
+    pool.emplace_back([&] {
+      uint64_t reads = 0, bad = 0;
+      uint32_t last = 0;
+      while (!done.load(std::memory_order_relaxed)) {
+        auto guard = registry.read();
+        const CompiledSchema* cs = guard.find("bench");
+        ++reads;
+        if (!cs || cs->version < last ||
+            cs->schema.fields.size() != schema.fields.size()) {
+          ++bad;
+          continue;
+        }
+        last = cs->version;
+      }
+      totalReads += reads;
+      badReads += bad;
+    });
+  }
+  auto t0 = std::chrono::steady_clock::now();
+  for (size_t v = 2; v <= publishes + 1; ++v) {
+    (void)registry.publish("bench", static_cast<uint32_t>(v),
+                           BinarySchema(schema));
+    if (v % 64 == 0) std::this_thread::yield();  // 読み手にも走らせる
+  }
+  const double sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - t0)
+                         .count();
+  done = true;
+  for (auto& t : pool) t.join();
+  if (badReads) fail("reader saw a missing or older version");
+  registry.collect();
+  if (registry.pendingReclaim() != 0) fail("catalogs left after collect");
+
+  // 読み手スロットをすべて埋める
+  std::vector<Result<SchemaRegistry::ReadGuard>> held;
+  for (;;) {
+    auto guard = registry.tryRead(1);
+    if (!guard) break;
+    held.push_back(std::move(guard));
+  }
+  if (held.size() != SchemaRegistry::maxReaders()) fail("reader slot count");
+  if (registry.tryRead(4).error() != StatusCode::BUSY)
+    fail("tryRead did not report BUSY");
+  (void)registry.publish("bench", static_cast<uint32_t>(publishes + 2),
+                         BinarySchema(schema));
+  if (registry.pendingReclaim() == 0) fail("catalog reclaimed under readers");
+  if (!held.empty() && held.front()->find("bench")->version != publishes + 1)
+    fail("held guard does not see its snapshot");
+  held.clear();
+  if (!registry.tryRead(1)) fail("tryRead failed after release");
+  registry.collect();
+  if (registry.pendingReclaim() != 0) fail("catalogs left after release");
+
+  std::cout << "publishes: " << publishes << ", readers: " << readerThreads
+            << "\n"
+            << std::fixed << std::setprecision(1)
+            << "publish: " << publishes / sec / 1e3 << " K/s, reads: "
+            << totalReads / sec / 1e6 << " M/s\n";
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6) << (failures ? "FAILED" : "OK") << "\n";
+  return failures ? 1 : 0;
+}
+
+// --- 使用例 ---
+static int runDemo(const BinarySchema& schema) {
+  DynamicRecord rec(schema);
+
+  constexpr uint8_t VERSION{1};
+  constexpr uint64_t MAGIC{0x123456789abcdeull};
+  constexpr uint32_t LENGTH{0x1357};
+  constexpr uint16_t HEADER_LENGTH{0x48};
+  constexpr uint16_t TYPE{0xab};
+
+  // operator[] を使ってフィールドに値を設定
+  rec["version"] = VERSION;              // 8bit
+  rec["magic"] = MAGIC;                  // 56bit
+  rec["length"] = LENGTH;                // 32bit
+  rec["header_length"] = HEADER_LENGTH;  // 16bit
+  rec["type"] = TYPE;                    // 16bit
+
+  // バイナリをファイルに書き出し
+  std::ofstream ofs("header.bin", std::ios::binary);
+  if (!ofs) {
+    std::cerr << "Error: could not open header.bin for writing\n";
+    return 1;
+  }
+  rec.write(ofs);
+  ofs.close();
+  std::cout << "Header was encoded and written to header.bin\n";
+
+  DynamicRecord rec2(schema);
+  std::ifstream ifs2("header.bin", std::ios::binary);
+  if (!ifs2) {
+    std::cerr << "Error: could not open header.bin for reading\n";
+    return 1;
+  }
+  rec2.read(ifs2);
+  ifs2.close();
+  std::cout << "Header was read and decoded from header.bin\n";
+
+  // operator[] を使ってフィールドから値を取得
+  std::cout << std::hex;
+  std::cout << "Version:       0x" << rec2["version"] << "\n";
+  std::cout << "Magic:         0x" << rec2["magic"] << "\n";
+  std::cout << "Length:        0x" << rec2["length"] << "\n";
   std::cout << "Header Length: 0x" << rec2["header_length"] << "\n";
   std::cout << "Type:          0x" << rec2["type"] << "\n";
   std::cout << std::dec;
@@ -291,5 +5921,124 @@ int main(int argc, char* argv[]) {
   assert(rec2["type"] == TYPE);
   std::cout << "All values match!\n";
 
+  if (kFieldProfiling)
+    std::cout << "Field accesses: " << schema.fieldProfileJson().dump(2)
+              << "\n";
   return 0;
 }
+
+// libFuzzer ビルドでは libFuzzer 側が main を持つ
+int main(int argc, char* argv[]) {
+  // ファジングは乱数スキーマを自前で作るのでスキーマファイルを取らない
+  if (argc >= 2 && std::string(argv[1]) == "fuzz") {
+    BenchOptions opts = BenchOptions::parse(argc, argv, 2);
+    return runFuzz(opts.getSize("iterations", 10000), opts.getSize("seed", 1),
+                   opts.getString("input", ""));
+  }
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <schema.json> [command]\n"
+              << "       " << argv[0]
+              << " fuzz [--iterations N] [--seed S] [--input file]\n"
+              << "Commands:\n"
+              << "  demo (default)\n"
+              << "  bench-pipeline [records] [busy|futex] [timed]\n"
+              << "  bench-async [streams] [records-per-stream]\n"
+              << "  bench-frames [--frames N] [--payload bytes] [--iovecs N]"
+                 " [--max-frames N] [--flush-bytes N]\n"
+              << "  bench-shm [--records N] [--consumers N] [--capacity N]\n"
+              << "  bench-latest [--updates N] [--readers N] [--channels N]"
+                 " [--key field]\n"
+              << "  bench-sink [--producers N] [--records N] [--capacity N]"
+                 " [--fail-every N] [--latency]\n"
+              << "  bench-dispatch [versions] [records]\n"
+              << "  bench-micro [--json out.json] [--min-time sec] [--perf]"
+                 " [--latency]\n"
+              << "  bench-macro [--size-mb N] [--threads N] [--warmup N]"
+                 " [--repeat N] [--file path] [--export path]"
+                 " [--json out.json]\n"
+              << "  bench-layouts [--layouts N] [--seed S] [--records N]\n"
+              << "  gen-schema [--seed S]\n"
+              << "  check-alloc (needs -DBINARY_SCHEMA_TRACK_ALLOC)\n"
+              << "  check-registry [--publishes N] [--readers N]\n"
+              << "Random schema options (gen-schema, bench-layouts, and\n"
+              << "bench-micro/bench-macro/bench-latest/bench-sink with\n"
+              << "--random-seed S):\n"
+              << "  --fields N --widths uniform|small|bytes|wide"
+                 " --aligned F --consts F --checksum 0|1\n";
+    return 1;
+  }
+  std::ifstream ifs(argv[1]);
+  if (!ifs) {
+    std::cerr << "Error: could not open " << argv[1] << "\n";
+    return 1;
+  }
+  nlohmann::json schemaJson;
+  ifs >> schemaJson;
+
+  BinarySchema schema;
+  schema.loadSchema(schemaJson);
+
+  std::string command = argc >= 3 ? argv[2] : "demo";
+  if (command == "demo") return runDemo(schema);
+  if (command == "bench-pipeline") {
+    size_t records = argc >= 4 ? std::stoull(argv[3]) : 10'000'000;
+    WaitMode mode = argc >= 5 && std::string(argv[4]) == "futex"
+                        ? WaitMode::FUTEX_WAIT
+                        : WaitMode::BUSY_POLL;
+    bool timed = argc >= 6 && std::string(argv[5]) == "timed";
+    return benchPipeline(schema, records, mode, timed);
+  }
+  if (command == "bench-micro" || command == "bench-macro") {
+    BenchOptions opts = BenchOptions::parse(argc, argv, 3);
+    BinarySchema random;
+    const BinarySchema& s = benchSchema(schema, opts, random);
+    return command == "bench-micro" ? benchMicro(s, opts)
+                                    : benchMacro(s, opts);
+  }
+  if (command == "check-alloc") return checkAllocations(schema);
+  if (command == "bench-latest") {
+    BenchOptions opts = BenchOptions::parse(argc, argv, 3);
+    BinarySchema random;
+    return benchLatest(benchSchema(schema, opts, random), opts);
+  }
+  if (command == "bench-layouts")
+    return benchLayouts(BenchOptions::parse(argc, argv, 3));
+  if (command == "gen-schema") {
+    BenchOptions opts = BenchOptions::parse(argc, argv, 3);
+    std::cout << generateRandomSchema(opts.getSize("seed", 1),
+                                      parseRandomSchemaOptions(opts.named))
+                     .dump(2)
+              << "\n";
+    return 0;
+  }
+  if (command == "check-registry")
+    return checkRegistry(schema, BenchOptions::parse(argc, argv, 3));
+  if (command == "bench-sink") {
+    BenchOptions opts = BenchOptions::parse(argc, argv, 3);
+    BinarySchema random;
+    return benchSink(benchSchema(schema, opts, random), opts);
+  }
+  if (command == "bench-dispatch") {
+    size_t versions = argc >= 4 ? std::stoull(argv[3]) : 16;
+    size_t records = argc >= 5 ? std::stoull(argv[4]) : 5'000'000;
+    if (versions == 0 || versions > 255) {
+      std::cerr << "Error: versions must be in 1..255\n";
+      return 1;
+    }
+    return benchDispatch(schemaJson, versions, records);
+  }
+#if defined(__linux__)
+  if (command == "bench-frames")
+    return benchFrames(schema, BenchOptions::parse(argc, argv, 3));
+  if (command == "bench-shm")
+    return benchShm(schema, BenchOptions::parse(argc, argv, 3));
+  if (command == "bench-async") {
+    size_t streams = argc >= 4 ? std::stoull(argv[3]) : 64;
+    size_t records = argc >= 5 ? std::stoull(argv[4]) : 100'000;
+    return benchAsyncPipes(schema, streams, records);
+  }
+#endif
+  std::cerr << "Error: unknown command " << command << "\n";
+  return 1;
+}
+#endif  // BINARY_SCHEMA_FUZZ